@@ -0,0 +1,162 @@
+#ifndef __apu_hh__
+#define __apu_hh__
+
+#include <vector>
+
+#include "common.hh"
+
+#include "blip.hh"
+#include "mixer.hh"
+
+class AudioLog;
+class CPU;
+class RAM;
+class StateReader;
+class StateWriter;
+
+// Audio processing unit, four channels: two squares (the first with frequency sweep), the
+// programmable wave channel and noise.
+//
+// The APU is not clocked every T-cycle.  Register writes are recorded with the T-cycle they
+// happened on, and once per frame (70224 T-cycles, the length of a video frame) endFrame
+// replays them in order with the 512 Hz frame sequencer steps in between.  Between two
+// events each channel only does work when its output level changes, and those changes are
+// added to a per-channel BlipBuffer as band-limited steps.  The Mixer then pans, sums and
+// resamples the frame to 48 kHz stereo, which goes to the AudioLog.
+//
+// With AudioMode=silent no samples are produced at all.  Only what a program can observe is
+// kept: the frame sequencer with its length counters, envelopes and sweep, which decide the
+// channel bits of NR52.  That state is brought up to date lazily, when a sound register is
+// read or written, rather than every frame.
+class APU {
+public:
+  static constexpr u32 frameLength = 70224;
+
+  APU();
+
+  void initialize( CPU*, RAM*, AudioLog* );
+  void setAudioLog( AudioLog* audioLog ) { this->audioLog = audioLog; }
+
+  // While muted the mixed output isn't sent to the AudioLog
+  void setMuted( bool muted ) { this->muted = muted; }
+
+  // Called every T-cycle with the number of cycles executed so far; only checks whether the
+  // current frame is over.
+  inline void
+  _clock( u64 ticks ) {
+    if( ticks >= frameEnd ) {
+      endFrame();
+    }
+  }
+
+  u8 read( u16 );
+  void write( u16, u8 );
+
+  // What the channels and the frame sequencer are doing, not the samples already made
+  void save( StateWriter& ) const;
+  void load( StateReader& );
+
+  // The samples synthesized for each channel by the last endFrame, at BlipBuffer::sampleRate
+  const std::vector< float >& channelSamples( int channel ) { return samples[ channel ]; }
+
+  // The mixed output of the last endFrame, interleaved left/right at Mixer::outputRate
+  const std::vector< float >& output() const { return mixer.output(); }
+
+private:
+  CPU* cpu;
+  RAM* ram;
+  AudioLog* audioLog;
+  bool muted = false;
+
+  struct RegisterWrite {
+    u32 time;  // T-cycles since the start of the frame
+    u16 address;
+    u8 data;
+  };
+
+  std::vector< RegisterWrite > writeLog;
+  std::size_t nextWrite = 0;  // first entry of writeLog not applied yet
+  u32 cursor = 0;             // T-cycle of the frame the channels have been run up to
+
+  bool silent = false;
+
+  u64 frameStart = 0;
+  u64 frameEnd = frameLength;
+  u64 sequencerNext = 8192;  // the frame sequencer steps at 512 Hz
+  int sequencerStep = 0;
+
+  bool power = true;
+
+  struct Channel {
+    bool enabled = false;
+    bool dacEnabled = false;
+
+    // Length counter
+    int length = 0;
+    bool lengthEnabled = false;
+
+    // Volume envelope (square and noise)
+    int volume = 0;
+    int envelopeInitial = 0;
+    bool envelopeUp = false;
+    int envelopePeriod = 0;
+    int envelopeTimer = 0;
+
+    int frequency = 0;  // 11-bit period value from NRx3/NRx4
+    int duty = 0;
+
+    // Waveform position.  timer counts T-cycles until the next step.
+    int timer = 0;
+    int position = 0;
+
+    int level = 0;  // the output level last handed to the blip buffer
+
+    // A field at a time; the struct has padding
+    void save( StateWriter& ) const;
+    void load( StateReader& );
+  };
+
+  Channel channels[ 4 ];
+
+  // Channel 1 sweep
+  int sweepPeriod = 0;
+  bool sweepNegate = false;
+  int sweepShift = 0;
+  int sweepTimer = 0;
+  bool sweepEnabled = false;
+  int sweepShadow = 0;
+
+  // Channel 3
+  int waveVolumeShift = 4;  // 4 mutes the channel
+  u8 waveRAM[ 16 ] = { 0 };
+
+  // Channel 4
+  int noiseShift = 0;
+  bool noiseWidth7 = false;
+  int noiseDivisor = 0;
+  u16 lfsr = 0x7fff;
+
+  u8 nr50 = 0;
+  u8 nr51 = 0;
+
+  BlipBuffer blips[ 4 ];
+  std::vector< float > samples[ 4 ];
+
+  Mixer mixer{ BlipBuffer::sampleRate };
+  std::vector< Mixer::Segment > segments;  // where NR50/NR51 changed during the frame
+
+  void endFrame();
+  void advance( u32 );
+  void catchUpSequencer( u64 );
+  bool sequencerIdle();
+  void apply( const RegisterWrite& );
+  void trigger( int );
+  void stepSequencer();
+  void run( int, u32, u32 );
+  int period( int );
+  int output( int );
+  int sweepCalculate();
+  void powerOff();
+};
+
+#endif
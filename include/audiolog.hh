@@ -0,0 +1,62 @@
+#ifndef __audiolog_hh__
+#define __audiolog_hh__
+
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common.hh"
+
+#include "spsc_ring.hh"
+
+// Records the mixed APU output, 16-bit stereo at Mixer::outputRate.  The APU hands each
+// frame's block of samples to a bounded lock-free queue; a worker thread converts them and
+// does the file I/O.  The WAV header is written with placeholder sizes up front and fixed
+// up when the log is closed.
+//
+// Config keys:
+//   AudioLog     output file
+//   AudioFormat  WAV or raw (little endian PCM, no header); defaults from the extension
+class AudioLog {
+public:
+  enum Format {
+    wav,
+    raw
+  };
+
+  // Opens the file named by the config keys, if any
+  AudioLog();
+  AudioLog( const std::string& fileName, Format );
+  ~AudioLog();
+
+  bool isEnabled() const { return enabled; }
+
+  // Interleaved left/right samples in the range -1 .. 1
+  void submit( const std::vector< float >& );
+
+private:
+  bool enabled = false;
+  Format format = raw;
+  std::string fileName;
+  std::ofstream os;
+
+  std::unique_ptr< SpscRing< std::vector< float > > > queue;
+  std::thread worker;
+  std::atomic< bool > done{ false };
+
+  u64 blocksSubmitted = 0;
+  u64 blocksDelayed = 0;  // blocks that had to wait for room in the queue
+  u64 bytesWritten = 0;   // only touched by the worker
+
+  std::vector< char > pcm;  // conversion buffer, only touched by the worker
+
+  void open( const std::string&, Format );
+  void run();
+  void write( const std::vector< float >& );
+  void writeHeader( u32 dataBytes );
+};
+
+#endif
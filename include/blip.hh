@@ -0,0 +1,43 @@
+#ifndef __blip_hh__
+#define __blip_hh__
+
+#include <vector>
+
+#include "common.hh"
+
+// Band-limited step synthesis in the style of blip_buf.  Instead of running a channel at
+// the APU clock and filtering the result, the channel reports only the moments its output
+// level changes.  Each change is added to the buffer as a band-limited step (an integrated,
+// windowed sinc) at the exact T-cycle it happened, so the cost follows the number of level
+// changes rather than the number of cycles.
+//
+// Times are T-cycles relative to the start of the current frame.  Output is produced at
+// 4194304 / 32 = 131072 samples per second.
+class BlipBuffer {
+public:
+  static constexpr int clocksPerSample = 32;
+  static constexpr int sampleRate = 4194304 / clocksPerSample;
+
+  BlipBuffer();
+
+  void addDelta( u32 time, int delta );
+
+  // Finishes a frame of the given length in T-cycles.  Returns the number of samples
+  // appended to out; time for the next frame starts at zero again.
+  int endFrame( u32 length, std::vector< float >& out );
+
+  void clear();
+
+private:
+  static constexpr int phases = clocksPerSample;
+  static constexpr int taps = 16;
+
+  static float kernel[ phases ][ taps ];
+  static bool kernelReady;
+
+  std::vector< float > deltas;
+  u32 offset = 0;  // T-cycles left over from the previous frame, always < clocksPerSample
+  float integrator = 0;
+};
+
+#endif
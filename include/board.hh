@@ -1,13 +1,22 @@
 #ifndef __board_hh__
-#define __board_hh_
+#define __board_hh__
 
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "common.hh"
 
+#include "apu.hh"
+#include "audiolog.hh"
 #include "bus.hh"
 #include "cpu.hh"
+#include "flightrecorder.hh"
+#include "framedump.hh"
+#include "gdbstub.hh"
+#include "ppu.hh"
 #include "ram.hh"
+#include "rewind.hh"
 #include "serial.hh"
 #include "timer.hh"
 
@@ -16,16 +25,63 @@ public:
   Board();
 
   u8 read8( u16 );
+  void write8( u16, u8 );
   void _clock();
 
+  // Replaces the cartridge named by the Cart config key, e.g. with a GBS image
+  void loadCartridge( std::vector< char > );
+  void setAudioLog( AudioLog* );
+  void connectLink( LinkPort*, u32 window );
+
+  // The serial oracle has a verdict, the cycle budget ran out, the Gameboy Doctor
+  // comparison is over or GDB killed the run
+  bool
+  isFinished() const {
+    auto doctor = cpu.getDoctor();
+    return serial.isFinished() || ( doctor && doctor->result() != GBDocCompare::running ) ||
+           ( gdbStub && gdbStub->isKilled() );
+  }
+  const SerialOracle& getOracle() const { return serial.getOracle(); }
+
   CPU& getCpu();
 
+  // The whole machine, one section per component; see state.hh.  Taken at an instruction
+  // boundary.  load throws std::runtime_error, before changing anything, if the state is
+  // for another cartridge or is missing a section this build can read.
+  void save( std::vector< u8 >& );
+  void load( const std::vector< u8 >& );
+
+  // The same, to and from a file; both throw std::runtime_error if the file can't be used
+  void saveState( const std::string& fileName );
+  void loadState( const std::string& fileName );
+
+  // Set while Rewind runs forward from a snapshot: nothing is written out (serial log,
+  // oracle, frames, audio, saved states), since it was all written the first time
+  void setReplaying( bool );
+
+  // Writes out the flight recorder, if it is on
+  void dumpFlightRecorder( const std::string& reason, const std::string& suffix = "" );
+
 private:
+  FlightRecorder flightRecorder;
   RAM ram;
   Bus bus;  // Bus needs to know about all the other components
   CPU cpu;  // CPU needs to know abou the bus only
   Timer timer;  // Timer needs to know about RAM and CPU
   Serial serial;
+  FrameDump frameDump;
+  PPU ppu;  // PPU needs to know about RAM, CPU and the frame dump
+  AudioLog audioLog;
+  APU apu;  // APU needs to know about RAM, CPU and the audio log
+  Rewind rewind;
+
+  // SaveState writes a state once the CPU gets to SaveStateAt
+  std::string saveStateFile;
+  u64 saveStateAt = UINT64_MAX;
+
+  bool replaying = false;
+
+  std::unique_ptr< GdbStub > gdbStub;  // last, so its thread stops before the rest goes
 };
 
 #endif
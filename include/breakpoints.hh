@@ -0,0 +1,136 @@
+#ifndef __breakpoints_hh__
+#define __breakpoints_hh__
+
+#include <string>
+#include <vector>
+
+#include "common.hh"
+
+class Bus;
+class CPU;
+
+// A breakpoint condition such as A==0x3 && [HL]>0x10, compiled once into a small stack
+// machine program.  Operands are numbers (decimal, 0x.. or $.. hex), the registers A F B C
+// D E H L AF BC DE HL SP PC, and [expr] for the byte at an address.  The operators are C's,
+// tightest first: ! ~ unary -, then + -, then the comparisons, &, ^, |, && and ||.  As in C,
+// && and || stop as soon as the answer is known.
+class Condition {
+public:
+  // No program: always true
+  Condition() = default;
+
+  // Throws std::runtime_error saying what is wrong with the text
+  explicit Condition( const std::string& );
+
+  bool isAlways() const { return code.empty(); }
+  const std::string& text() const { return source; }
+
+  bool evaluate( const CPU&, Bus& ) const;
+
+private:
+  enum Op : u8 {
+    push,         // operand
+    reg8,         // operand is the register
+    reg16,
+    read,         // replaces the address on the stack with the byte there
+    logicalNot,
+    complement,
+    negate,
+    add,
+    subtract,
+    bitAnd,
+    bitXor,
+    bitOr,
+    equal,
+    notEqual,
+    less,
+    lessEqual,
+    greater,
+    greaterEqual,
+    toBool,
+    jumpIfFalse,  // to operand, leaving the value; otherwise drops it
+    jumpIfTrue
+  };
+
+  struct Instruction {
+    Op op;
+    u16 operand;
+  };
+
+  static constexpr int maxDepth = 16;
+
+  std::vector< Instruction > code;
+  std::string source;
+
+  // Parser state, only used by the constructor
+  std::size_t at = 0;
+  int depth = 0;
+  int maxSeen = 0;
+
+  void emit( Op, u16 operand = 0 );
+  void parseOr();
+  void parseAnd();
+  void parseCompare();
+  void parseBitOr();
+  void parseBitXor();
+  void parseBitAnd();
+  void parseSum();
+  void parseUnary();
+  void parsePrimary();
+
+  void skipSpace();
+  bool accept( const char* );
+  [[ noreturn ]] void fail( const std::string& );
+};
+
+// PC breakpoints, checked each time the CPU fetches an instruction.  Addresses are kept in
+// a bitmap with a flag per 256-byte page in front of it, so a fetch from a page without any
+// breakpoints costs one table lookup.  A breakpoint in 0x4000 - 0x7fff may name a ROM
+// bank, and any breakpoint may have a Condition; both are only looked at once the bitmap
+// says the address is set.
+//
+// Written as [bank:]address [if condition], addresses in hex, e.g. 2:4a10 if A==0x3.  The
+// Breakpoints config key takes a list separated by ';'.
+class Breakpoints {
+public:
+  Breakpoints();
+
+  void initialize( Bus* );
+
+  // Throws std::runtime_error on a badly written breakpoint
+  void add( const std::string& );
+  bool remove( u16 address );
+  void clear();
+
+  bool empty() const { return entries.empty(); }
+
+  // The breakpoints, one per line, as they were written
+  std::string list() const;
+
+  inline bool
+  hit( u16 pc, const CPU& cpu ) {
+    if( pages[ pc >> 8 ] == 0 || ( ( bits[ pc >> 6 ] >> ( pc & 63 ) ) & 1 ) == 0 ) {
+      return false;
+    }
+
+    return hitSlow( pc, cpu );
+  }
+
+private:
+  struct Entry {
+    u16 address;
+    int bank;  // -1 for any
+    Condition condition;
+  };
+
+  Bus* bus = nullptr;
+  std::vector< Entry > entries;
+
+  u8 pages[ 256 ] = { 0 };
+  u64 bits[ 1024 ] = { 0 };
+
+  void rebuild();
+  bool hitSlow( u16 pc, const CPU& );
+};
+
+#endif
@@ -5,8 +5,11 @@
 
 #include "common.hh"
 
+class APU;
 class CPU;
+class FlightRecorder;
 class RAM;
+class PPU;
 class Timer;
 struct Serial;
 
@@ -88,6 +91,8 @@ public:
     NR52   = 0xFF26,
     SOUND_START = NR10,
     SOUND_END = 0xff3f,
+    WAVE_START = 0xFF30,
+    WAVE_END = 0xFF3F,
     LCDC   = 0xFF40,
     STAT   = 0xFF41,
     SCY    = 0xFF42,
@@ -102,15 +107,25 @@ public:
     WX     = 0xFF4B,
   };
 
-  void initialize( CPU*, RAM*, Timer*, Serial* );
+  void initialize( CPU*, RAM*, Timer*, Serial*, PPU*, APU* );
+  void setFlightRecorder( FlightRecorder* );
 
   u8 read( u16 );
   void write( u16, u8 );
-  void dbgWrite( u16, u8 );
+
+  // Reads and writes memory as it is, whatever the PPU has locked; see RAM::peek.  IO
+  // registers still go through doIO.  poke returns false for the cartridge ROM and for IO
+  // registers the emulator doesn't implement.
+  u8 peek( u16 );
+  bool poke( u16, u8 );
+
+  // ROM bank mapped at 0x4000
+  u8 romBank();
 
   std::string hexDump( u16, u16 );
 
-  void doIO( u16, u8 );
+  // False, having done nothing, for a register that isn't implemented
+  bool doIO( u16, u8 );
 
   Timer* getTimer();
   CPU* getCPU();
@@ -120,6 +135,9 @@ private:
   RAM* ram;
   Timer* timer;
   Serial* serial;
+  PPU* ppu;
+  APU* apu;
+  FlightRecorder* recorder = nullptr;
 };
 
 #endif
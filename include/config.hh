@@ -1,6 +1,7 @@
 #ifndef __config_hh__
 #define __config_hh__
 
+#include <cstdint>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -20,6 +21,14 @@ public:
   std::string
   GetValue( std::string );
 
+  // The value as a number, or fallback when the key is missing.  Throws std::runtime_error
+  // naming the key if the value isn't a whole non-negative number in base.
+  std::uint64_t
+  GetNumber( const std::string& key, std::uint64_t fallback, int base = 10 );
+
+  void
+  RemoveKey( const std::string& );
+
   const std::string&
   GetFileName();
 
@@ -1,5 +1,5 @@
 #ifndef __cpu_hh__
-#define __cpu_hh_
+#define __cpu_hh__
 
 #include <cstddef>
 #include <fstream>
@@ -7,17 +7,31 @@
 #include <memory>
 #include <sstream>
 #include <string>
+#include <vector>
 
+#include "breakpoints.hh"
 #include "common.hh"
 #include "dictionary.hh"
+#include "gbdoccompare.hh"
+#include "trace.hh"
+#include "tracecodec.hh"
+#include "tracefilter.hh"
 
 class Bus;
+class FlightRecorder;
+class GdbStub;
+class Rewind;
+class StateReader;
+class StateWriter;
 
 class CPU {
 public:
   CPU();
 
   void initialize( Bus* );
+  void setFlightRecorder( FlightRecorder* );
+  void setGdbStub( GdbStub* );
+  void setRewind( Rewind* );
 
   void _clock();
 
@@ -75,6 +89,24 @@ public:
   void triggerInterrupt( Interrupt );
   void triggerStatInterrupt();
 
+  // Pushes PC and jumps to address, as if a CALL had just executed
+  void call( u16 address );
+
+  // True when the next _clock will fetch a new instruction
+  bool atInstructionBoundary() { return ticks + 1 >= waitUntilTicks; }
+
+  // Registers and the timing of the next fetch; only taken at an instruction boundary
+  void save( StateWriter& ) const;
+  void load( StateReader& );
+
+  // While the debugger replays from a snapshot nothing may stop the run or write a trace.
+  // The tick of every fetch (everyFetch) or of every breakpoint hit goes to log instead.
+  void beginReplay( std::vector< u64 >* log, bool everyFetch );
+  void endReplay();
+
+  // Enters the debugger at the next fetch
+  void stopAtNextInstruction();
+
   // TODO: remove AddressingModes, not as helpful as I though it would be.
   enum AddressingModes {
     am_ins, // instruction encoding has all the necessary info
@@ -109,7 +141,6 @@ public:
   u8 CP( const InstDetails&, u8, u8 );
   u8 CPL( const InstDetails&, u8, u8 ) { throw std::runtime_error( "CPL not implemented" ); }
   u8 DAA( const InstDetails&, u8, u8 ) { throw std::runtime_error( "DAA not implemented" ); }
-  u8 DBG( const InstDetails&, u8, u8 );
   u8 DEC( const InstDetails&, u8, u8 );
   u8 DI( const InstDetails&, u8, u8 );
   u8 EI( const InstDetails&, u8, u8 ) { throw std::runtime_error( "EI not implemented" ); }
@@ -149,9 +180,27 @@ public:
   u8 XOR( const InstDetails&, u8, u8 );
 
   std::string debugSummary( const InstDetails&, u8, u8 );
-  std::string debugGameboyDoctor( const InstDetails &, u8, u8 );
 
-  std::string (CPU::*tracer)(const InstDetails &, u8, u8) = &CPU::debugSummary;
+  // The state of the machine as instr is about to run, and the two text layouts for it
+  TraceRecord traceRecord( const InstDetails&, u8, u8 );
+  std::string debugSummary( const TraceRecord& );
+  std::string debugGameboyDoctor( const TraceRecord& );
+
+  // The same layouts written to line, which holds traceLineSize characters, without a
+  // newline.  Return the end of the text.
+  char* formatSummary( const TraceRecord&, char* line );
+  char* formatGameboyDoctor( const TraceRecord&, char* line );
+  static constexpr std::size_t traceLineSize = 256;
+
+  // Lengths and cycle counts for the trace encoder
+  TraceOpcodes traceOpcodes();
+
+  Breakpoints& getBreakpoints() { return breakpoints; }
+
+  // Set when comparing against a Gameboy Doctor log
+  const GBDocCompare* getDoctor() const { return doctor.get(); }
+
+  char* (CPU::*tracer)( const TraceRecord&, char* ) = &CPU::formatSummary;
 
   // This method halts everything until it returns
   void debug(const InstDetails &, u8, u8);
@@ -192,8 +241,32 @@ private:
 
 private:
   Bus* bus;
-  u8 debugOpcode = 0xd3;
+  FlightRecorder* recorder = nullptr;
+  GdbStub* gdb = nullptr;
+  Rewind* rewind = nullptr;
   std::ofstream trace;
+  char traceLine[ traceLineSize + 1 ];  // room for the newline
+  std::unique_ptr< TraceWriter > traceWriter;  // set for TraceFormat=binary
+  TraceFilter traceFilter;
+  std::unique_ptr< GBDocCompare > doctor;
+
+  // Each instrs[ i ].desc split once into literal text and operand slots, so a trace line is
+  // put together without searching the description
+  struct DescPiece {
+    enum Slot {
+      literal,
+      d8,
+      d16,
+      a8,
+      a16,
+      r8
+    } slot;
+    std::string text;  // for literal
+  };
+
+  std::vector< DescPiece > descTemplates[ 512 ];
+
+  void parseDescTemplates();
 
   dictionary< Interrupt, u16 > interruptHandler {
     { Interrupt::VBlank, 0x40 },
@@ -214,7 +287,7 @@ private:
 
   bool checkCondCode( u8 );
 
-  dictionary< u16, u8 > breakpoints;
+  Breakpoints breakpoints;
 
   std::ostream& formatHex( std::ostream&, int );
 
@@ -228,8 +301,6 @@ private:
   int Hmask = 0b0010'0000;
   int Cmask = 0b0001'0000;
 
-  u16 prefixForAddress = -1;
-
   InstDetails ins_decode;
   u8 params[ 2 ] = { 0 };
 
@@ -241,12 +312,23 @@ private:
   std::vector< void ( CPU::* )() > preExec;
 
   void Trace();
+  void Doctor();
   void Step();
+  void RecordFetch();
+
+  // Set between beginReplay and endReplay
+  bool replaying = false;
+  std::vector< u64 >* replayLog = nullptr;
+  std::vector< void ( CPU::* )() > savedPreExec;
+  GdbStub* savedGdb = nullptr;
 
   bool dbgStep(std::stringstream &);
   bool dbgDump( std::stringstream& );
   bool dbgBreak( std::stringstream& );
+  bool dbgDelete( std::stringstream& );
   bool dbgContinue( std::stringstream& );
+  bool dbgReverseStep( std::stringstream& );
+  bool dbgReverseContinue( std::stringstream& );
   bool dbgPoke( std::stringstream& );
   bool dbgSetPC( std::stringstream& );
 
@@ -261,10 +343,15 @@ private:
     { "s",        { &CPU::dbgStep, "" } },
     { "dump",     { &CPU::dbgDump, "(d)ump <address>" } },
     { "d",        { &CPU::dbgDump, "" } },
-    { "break",    { &CPU::dbgBreak, "(b)reak <address>" } },
+    { "break",    { &CPU::dbgBreak, "(b)reak [[bank:]address [if condition]]" } },
     { "b",        { &CPU::dbgBreak, "" } },
+    { "delete",   { &CPU::dbgDelete, "delete [address]" } },
     { "continue", { &CPU::dbgContinue, "(c)ontinue" } },
     { "c",        { &CPU::dbgContinue, "" } },
+    { "reverse-step",     { &CPU::dbgReverseStep, "reverse-step (rs)" } },
+    { "rs",               { &CPU::dbgReverseStep, "" } },
+    { "reverse-continue", { &CPU::dbgReverseContinue, "reverse-continue (rc)" } },
+    { "rc",               { &CPU::dbgReverseContinue, "" } },
     { "poke",     { &CPU::dbgPoke, "(p)oke <address> <data>" } },
     { "p",        { &CPU::dbgPoke, "" } },
     { "setPC",    { &CPU::dbgSetPC, "setPC <address>" } }
@@ -0,0 +1,83 @@
+#ifndef __flightrecorder_hh__
+#define __flightrecorder_hh__
+
+#include <string>
+#include <vector>
+
+#include "common.hh"
+
+class Bus;
+class CPU;
+
+// Keeps the last instructions executed and the last bus writes in two rings, cheaply enough
+// to stay on all the time.  When a run dies the rings are written out, oldest first and
+// merged by tick, next to an image of the whole address space, so the failure can be looked
+// at without running it again with a trace.
+//
+// Config keys:
+//   FlightRecorder  how many instructions and writes to keep, defaults to 65536; 0 turns the
+//                   recorder off
+//   FlightDump      file name prefix for the dump, defaults to flight; the dump is
+//                   <prefix>.txt and the memory image <prefix>.mem
+class FlightRecorder {
+public:
+  FlightRecorder();
+
+  bool isEnabled() const { return enabled; }
+
+  inline void
+  instruction( u64 tick, u16 pc, u16 opcode, u16 AF, u16 BC, u16 DE, u16 HL, u16 SP, u8 param1, u8 param2 ) {
+    Instruction& entry = instructions[ instructionCount++ & mask ];
+    entry.tick = tick;
+    entry.pc = pc;
+    entry.opcode = opcode;
+    entry.AF = AF;
+    entry.BC = BC;
+    entry.DE = DE;
+    entry.HL = HL;
+    entry.SP = SP;
+    entry.params[ 0 ] = param1;
+    entry.params[ 1 ] = param2;
+  }
+
+  inline void
+  write( u64 tick, u16 address, u8 data ) {
+    Write& entry = writes[ writeCount++ & mask ];
+    entry.tick = tick;
+    entry.address = address;
+    entry.data = data;
+  }
+
+  // Writes the dump files; suffix tells apart the Boards of one process
+  void dump( const std::string& reason, CPU&, Bus&, const std::string& suffix = "" );
+
+private:
+  struct Instruction {
+    u64 tick;
+    u16 pc;
+    u16 opcode;
+    u16 AF;
+    u16 BC;
+    u16 DE;
+    u16 HL;
+    u16 SP;
+    u8 params[ 2 ];
+  };
+
+  struct Write {
+    u64 tick;
+    u16 address;
+    u8 data;
+  };
+
+  bool enabled = false;
+  std::string prefix = "flight";
+
+  std::size_t mask = 0;
+  std::vector< Instruction > instructions;
+  std::vector< Write > writes;
+  u64 instructionCount = 0;
+  u64 writeCount = 0;
+};
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef __framedump_hh__
+#define __framedump_hh__
+
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "common.hh"
+
+#include "renderer.hh"
+#include "spsc_ring.hh"
+
+// Records every finished frame for regression evidence.  The renderer hands frames to a bounded
+// lock-free queue; a worker thread does the encoding and file I/O so the emulation thread
+// only pays for a frame copy.  Frames whose hash matches the previous frame are not copied
+// or encoded again; the worker repeats the last encoded frame instead.
+//
+// Config keys:
+//   VideoLog          output file; for PNG output the frame number is added to the name
+//   VideoFormat       Y4M, PNG or raw (defaults from the VideoLog extension)
+//   VideoQueuePolicy  block (backpressure the emulator) or drop (discard the new frame)
+//   VideoQueueSize    number of frames the queue holds, defaults to 16
+//   FrameHashLog      one line per frame with its hash, for comparing runs without pixels
+class FrameDump {
+public:
+  FrameDump();
+  ~FrameDump();
+
+  void submit( const Renderer::Frame&, u64 number, u64 hash, bool duplicate );
+
+  enum Format {
+    y4m,
+    png,
+    raw
+  };
+
+  enum Policy {
+    block,
+    drop
+  };
+
+private:
+  struct Item {
+    Renderer::Frame frame;
+    u64 number;
+    bool repeat;  // same pixels as the previous item, frame is not filled in
+  };
+
+  bool enabled = false;
+  Format format = raw;
+  Policy policy = block;
+  std::string fileName;
+  std::ofstream os;
+  std::ofstream hashLog;
+
+  std::unique_ptr< SpscRing< Item > > queue;
+  std::thread worker;
+  std::atomic< bool > done{ false };
+
+  u64 framesSubmitted = 0;
+  u64 framesDropped = 0;
+  u64 framesRepeated = 0;
+  u64 framesWritten = 0;  // only touched by the worker
+  bool lastDropped = false;
+
+  // The last encoded frame, only touched by the worker
+  char luma[ Renderer::Width * Renderer::Height ] = { 0 };
+
+  void run();
+  void write( const Item& );
+  void writePNG( const Renderer::Frame&, u64 );
+  std::string pngFileName( u64 );
+};
+
+#endif
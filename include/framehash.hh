@@ -0,0 +1,64 @@
+#ifndef __framehash_hh__
+#define __framehash_hh__
+
+#include <cstddef>
+#include <cstring>
+
+#include "common.hh"
+
+// xxHash (XXH3) style hashing for frame buffers.  Lines are hashed as the PPU finishes
+// them and the line hashes are folded into one hash per frame.  The stripe loop works on
+// four independent 64-bit lanes using only 32x32->64 multiplies, which the compiler turns
+// into packed multiplies (pmuludq and friends) at -O2.
+
+constexpr u64 hashPrime1 = 0x9e3779b185ebca87ULL;
+constexpr u64 hashPrime2 = 0xc2b2ae3d27d4eb4fULL;
+constexpr u64 hashPrime3 = 0x165667b19e3779f9ULL;
+
+inline u64
+hashAvalanche( u64 h ) {
+  h ^= h >> 37;
+  h *= 0x165667919e3779f9ULL;
+  h ^= h >> 32;
+  return h;
+}
+
+inline u64
+hashLine( const u8* data, std::size_t length ) {
+  static const u64 secret[ 4 ] = {
+    0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL,
+    0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL,
+  };
+
+  u64 acc[ 4 ] = { hashPrime3, hashPrime1, hashPrime2, hashPrime3 ^ length };
+
+  std::size_t i = 0;
+  for( ; i + 32 <= length; i += 32 ) {
+    u64 lanes[ 4 ];
+    std::memcpy( lanes, data + i, sizeof( lanes ) );
+
+    for( int lane = 0; lane < 4; lane++ ) {
+      u64 key = lanes[ lane ] ^ secret[ lane ];
+      acc[ lane ] += ( key & 0xffffffff ) * ( key >> 32 );
+      acc[ lane ] += lanes[ lane ^ 1 ];
+    }
+  }
+
+  u64 h = acc[ 0 ] ^ ( acc[ 1 ] * hashPrime1 ) ^ ( acc[ 2 ] * hashPrime2 ) ^ ( acc[ 3 ] * hashPrime3 );
+
+  for( ; i < length; i++ ) {
+    h = ( h ^ data[ i ] ) * hashPrime1;
+  }
+
+  return hashAvalanche( h );
+}
+
+// Folds a line hash into the running frame hash.  Order matters, so moving a line to a
+// different row changes the frame hash.
+inline u64
+hashCombine( u64 frameHash, u64 lineHash ) {
+  frameHash ^= lineHash + hashPrime2 + ( frameHash << 6 ) + ( frameHash >> 2 );
+  return frameHash * hashPrime1;
+}
+
+#endif
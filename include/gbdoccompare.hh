@@ -0,0 +1,72 @@
+#ifndef __gbdoccompare_hh__
+#define __gbdoccompare_hh__
+
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "common.hh"
+
+#include "trace.hh"
+
+// Runs the emulator against a Gameboy Doctor log instead of writing one.  Each instruction
+// is compared with the next line of the reference as it is about to execute; lines are
+// parsed into numbers and nothing is formatted unless the two disagree.  The run stops at
+// the first difference, which is reported with the instructions leading up to it, or once
+// the reference runs out.  Logs ending in .gz are read through gzip -dc.
+//
+// Config keys:
+//   DoctorLog      reference log; also makes LY read 0x90 as Gameboy Doctor expects
+//   DoctorContext  matching instructions to show before a difference, defaults to 8
+class GBDocCompare {
+public:
+  enum Result {
+    running,
+    matched,    // every line of the reference was matched
+    diverged,
+    unreadable  // the reference was empty, or gzip couldn't decompress it
+  };
+
+  using Formatter = std::function< std::string( const TraceRecord& ) >;
+
+  GBDocCompare( const std::string& fileName, Formatter );
+  ~GBDocCompare();
+
+  // False once there is a result
+  bool check( const TraceRecord& );
+
+  Result result() const { return outcome; }
+  u64 linesMatched() const { return matchedLines; }
+
+  static const char* name( Result );
+
+private:
+  struct Expected {
+    u8 regs[ 8 ];  // A F B C D E H L
+    u16 SP;
+    u16 PC;
+    u8 pcmem[ 4 ];
+  };
+
+  std::string fileName;
+  Formatter format;
+  FILE* is = nullptr;
+  bool piped = false;
+
+  char* line = nullptr;
+  std::size_t lineCapacity = 0;
+
+  Result outcome = running;
+  u64 matchedLines = 0;
+
+  // The last few matched instructions, for context
+  std::vector< TraceRecord > history;
+  std::size_t contextSize = 8;
+
+  void endOfReference();
+  bool parse( const char*, Expected& );
+  void report( const TraceRecord&, const Expected&, bool parsed );
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef __gbs_hh__
+#define __gbs_hh__
+
+#include <string>
+#include <vector>
+
+#include "common.hh"
+
+// A GBS (Game Boy Sound) file: a 0x70 byte header followed by the music code and data,
+// which are loaded at loadAddress.  The init routine is called once per track with the
+// track number (from 0) in A, then the play routine at the VBlank rate or, when the timer
+// bits of timerControl are set, at the timer overflow rate.
+//
+// Offset  Size  Field
+// 0x00    3     "GBS"
+// 0x03    1     version (1)
+// 0x04    1     number of tracks
+// 0x05    1     first track (from 1)
+// 0x06    2     load address
+// 0x08    2     init address
+// 0x0a    2     play address
+// 0x0c    2     stack pointer
+// 0x0e    1     timer modulo (TMA)
+// 0x0f    1     timer control (TAC)
+// 0x10    32    title
+// 0x30    32    author
+// 0x50    32    copyright
+class GBS {
+public:
+  static constexpr u16 headerSize = 0x70;
+
+  // Where init and play return to.  image() puts an endless JR there, so the CPU idles
+  // until the player calls the next routine.  Clear of the RST and interrupt vectors.
+  static constexpr u16 returnAddress = 0x0100;
+
+  explicit GBS( const std::string& fileName );
+
+  // A cartridge image with the code at loadAddress, in 16 KiB banks for MBC1 style banking.
+  // RST n jumps on to loadAddress + n and the interrupt vectors to loadAddress + 0x40 ...,
+  // as the GBS format expects.
+  std::vector< char > image() const;
+
+  // T-cycles between two calls to the play routine
+  u32 playPeriod() const;
+
+  u8 trackCount;
+  u8 firstTrack;
+  u16 loadAddress;
+  u16 initAddress;
+  u16 playAddress;
+  u16 stackPointer;
+  u8 timerModulo;
+  u8 timerControl;
+  std::string title;
+  std::string author;
+  std::string copyright;
+
+private:
+  std::vector< char > data;  // everything after the header
+};
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef __gbsplayer_hh__
+#define __gbsplayer_hh__
+
+#include <string>
+
+#include "common.hh"
+
+#include "gbs.hh"
+
+// Renders every track of a GBS file to its own WAV file, running the emulator flat out with
+// no video.  Each track gets a fresh Board: the init routine is called with the track
+// number, then the play routine every GBS::playPeriod T-cycles until the track length is
+// reached.
+//
+// The track Boards are built from the main config less the keys that would write files,
+// open sockets, load or save states or stop in a debugger; those are for running Cart, and
+// a warning is logged for each one that is set.
+//
+// Config keys:
+//   GBS         the GBS file; its presence selects player mode instead of running Cart
+//   GBSOutput   output name, "-NN.wav" is added per track; defaults to the GBS file name
+//   GBSSeconds  length of every track, defaults to 120
+class GBSPlayer {
+public:
+  GBSPlayer();
+
+  // Returns the exit status for main
+  int run();
+
+private:
+  std::string fileName;
+  std::string outputName;
+  u64 seconds = 120;
+
+  int renderTracks();
+  void renderTrack( const GBS&, int track, const std::string& wavName );
+};
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef __gdbstub_hh__
+#define __gdbstub_hh__
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+#include "common.hh"
+
+class Bus;
+class CPU;
+
+// GDB remote serial protocol server.  A thread listens on the socket and talks to the
+// debugger, while the emulator runs at full speed.  The CPU asks the stub at each fetch
+// whether to stop, which is an atomic load unless a breakpoint is set on the page; when it
+// does stop it parks in stop() until the debugger continues, steps, detaches or kills.  The
+// debugger only reads and changes the machine while it is parked.
+//
+// The registers are AF BC DE HL SP PC, 16 bits each, in that order.  Breakpoints set with
+// Z0/Z1 go into the CPU's breakpoints, so they cost the same as the debugger's own.
+//
+// Config keys:
+//   GdbStub  a TCP port on localhost, or the path of a Unix domain socket
+//   GdbWait  true to stop before the first instruction until a debugger connects
+class GdbStub {
+public:
+  // Throws std::runtime_error if the socket can't be set up
+  GdbStub( const std::string& address, bool wait );
+  ~GdbStub();
+
+  void initialize( CPU*, Bus* );
+
+  inline bool stopRequested() const { return stopping.load( std::memory_order_relaxed ); }
+
+  // Called by the CPU on its own thread.  Returns true if the debugger changed PC or memory,
+  // so the current instruction has to be fetched again.
+  bool stop();
+
+  // The debugger sent a kill
+  bool isKilled() const { return killed.load( std::memory_order_relaxed ); }
+
+private:
+  enum Signal {
+    sigint = 2,
+    sigtrap = 5
+  };
+
+  CPU* cpu = nullptr;
+  Bus* bus = nullptr;
+
+  std::string address;
+  int listener = -1;
+  int client = -1;
+  std::thread worker;
+  std::mutex sendMutex;  // both threads send
+
+  std::atomic< bool > stopping{ false };
+  std::atomic< bool > killed{ false };
+  std::atomic< bool > done{ false };
+
+  // Shared with the emulator thread, under mutex
+  std::mutex mutex;
+  std::condition_variable parkedChanged;
+  bool parked = false;
+  bool replyPending = false;  // the debugger is waiting to hear why the emulator stopped
+  bool changed = false;
+  Signal signal = sigtrap;
+
+  std::set< u16 > ownBreakpoints;  // the ones the debugger set, dropped when it goes away
+
+  void run();
+  void serve();
+  void waitUntilParked( std::unique_lock< std::mutex >& );
+  void resume( bool step );
+  void release();
+
+  bool handle( const std::string& packet );  // false ends the session
+  bool dispatch( const std::string& packet );  // handle, with the emulator parked
+  std::string readRegisters();
+  std::string readMemory( const std::string& );
+  std::string writeMemory( const std::string& );
+  std::string readRegister( const std::string& );
+  std::string writeRegister( const std::string& );
+  std::string breakpoint( const std::string&, bool insert );
+  std::string query( const std::string& );
+
+  u16 getRegister( int );
+  void setRegister( int, u16 );
+
+  void send( const std::string& packet );
+  void sendRaw( const std::string& );
+};
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef __link_hh__
+#define __link_hh__
+
+#include "common.hh"
+
+// What one side of a link cable tells the other at the end of every lockstep window.
+//
+// Both emulators run the same number of T-cycles per window and then swap one message.
+// A byte takes 4096 T-cycles to shift out on the internal clock, and a window is always
+// shorter than that, so a transfer started during a window is always still in flight when
+// the window ends.  Each side therefore learns the other's byte before its own transfer
+// has to finish, and both can complete it, and raise the serial interrupt, on the exact
+// cycle real hardware would.
+struct LinkMessage {
+  u8 sb = 0xff;          // SB at the end of the window, shifted out if the peer clocks a byte
+  bool armed = false;    // SC has a transfer pending on the external clock
+  bool started = false;  // a transfer on the internal clock started during the window
+  u32 startOffset = 0;   // when it started, T-cycles into the window
+  u8 data = 0xff;        // the byte it is shifting out
+};
+
+// The other end of the link cable
+class LinkPort {
+public:
+  virtual ~LinkPort() = default;
+
+  // Sends this side's message for the window that just ended and waits for the peer's
+  // message for the same window.  Returns false once the peer is gone.
+  virtual bool exchange( const LinkMessage& out, LinkMessage& in ) = 0;
+};
+
+#endif
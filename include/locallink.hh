@@ -0,0 +1,59 @@
+#ifndef __locallink_hh__
+#define __locallink_hh__
+
+#include <atomic>
+#include <functional>
+
+#include "common.hh"
+
+#include "link.hh"
+
+class Board;
+
+// Link cable between two Boards in the same process.  Each side has a slot it publishes its
+// window message in; the other side waits for the slot's sequence number to reach the same
+// window and reads it.  Messages alternate between two buffers by window parity, so a side
+// can post window k + 1 while the other is still reading window k.  There are no locks and
+// no system calls.
+//
+// run() drives both Boards, either on two threads that meet at every window boundary, or
+// on the calling thread: the first Board runs and, whenever it waits at a boundary, clocks
+// the second one until it gets there too.  The second Board is then never more than one
+// window behind.
+class LocalLink {
+public:
+  explicit LocalLink( u32 window = 2048 );
+
+  void connect( Board&, Board& );
+
+  // Runs both Boards for cycles T-cycles, or until one of them throws if cycles is 0.  An
+  // exception from either Board is rethrown here once both have stopped.  Either way the
+  // Board that stops second may be up to one window short.
+  void run( u64 cycles, bool twoThreads );
+
+private:
+  class End : public LinkPort {
+  public:
+    bool exchange( const LinkMessage& out, LinkMessage& in ) override;
+
+    LocalLink* cable;
+    int side;
+    u64 window = 0;
+    std::function< void() > runPeer;  // set when both Boards share one thread
+  };
+
+  struct alignas( 64 ) Slot {
+    std::atomic< u64 > sequence{ 0 };
+    LinkMessage messages[ 2 ];
+  };
+
+  u32 window;
+  Board* boards[ 2 ] = { nullptr, nullptr };
+  End ends[ 2 ];
+  Slot slots[ 2 ];
+  std::atomic< bool > closed{ false };
+
+  void runBoard( int, u64 );
+};
+
+#endif
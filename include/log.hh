@@ -1,30 +1,117 @@
 #ifndef __log_hh__
 #define __log_hh__
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
 #include <fstream>
 #include <string>
+#include <thread>
 
+#include "mpsc_ring.hh"
+
+// Lowest level compiled in; GBE_LOG calls below it generate no code.  Build with
+// -DGBE_LOG_LEVEL=0 to keep debug messages.
+#ifndef GBE_LOG_LEVEL
+#define GBE_LOG_LEVEL 1
+#endif
+
+// Messages are queued with their time and written to the file by a worker thread, so a
+// caller only pays for formatting its own text.  Write takes a finished string; GBE_LOG
+// takes a printf format and only formats it when the message is going to be written.
+//
+// Each GBE_LOG call site is rate limited: the first siteBurst messages are written, then at
+// most one a second, which reports how many were suppressed since the last one.  Whatever
+// is still suppressed when the log closes is reported then.
 class Log {
 public:
   enum LogType {
+    debug,
     info,
     warn,
-    error,
-    debug
+    error
+  };
+
+  static constexpr LogType minimum = static_cast< LogType >( GBE_LOG_LEVEL );
+
+  // State for one GBE_LOG call site
+  struct Site {
+    Site( const char* file, int line );
+
+    const char* file;
+    int line;
+    std::atomic< unsigned long > count{ 0 };
+    std::atomic< long > lastSecond{ -1 };
+    std::atomic< unsigned long > suppressed{ 0 };
+    Site* next;
   };
 
   Log( std::string fileName );
   ~Log();
 
   void
-  Write( LogType, std::string );
+  Write( LogType, const std::string& );
+
+  template < typename... Args >
+  void
+  write( Site& site, LogType type, const char* format, Args... args ) {
+    unsigned long suppressed = 0;
+    if( !admit( site, suppressed ) ) {
+      return;
+    }
+
+    char buffer[ 1024 ];
+    int length = snprintf( buffer, sizeof( buffer ), format, args... );
+    std::string message;
+    if( length >= static_cast< int >( sizeof( buffer ) ) ) {
+      message.resize( length + 1 );
+      snprintf( &message[ 0 ], message.size(), format, args... );
+      message.resize( length );
+    }
+    else {
+      message.assign( buffer, std::max( length, 0 ) );
+    }
+
+    if( suppressed > 0 ) {
+      message += " (suppressed " + std::to_string( suppressed ) + " repeats)";
+    }
+    Write( type, message );
+  }
 
   std::string
   toString( LogType );
 
 private:
+  static constexpr unsigned long siteBurst = 10;
+
+  struct Entry {
+    std::chrono::system_clock::time_point time;
+    LogType type;
+    std::string text;
+  };
+
   std::ofstream os;
+  MpscRing< Entry > queue{ 1024 };
+  std::thread worker;
+  std::atomic< bool > done{ false };
+  std::atomic< unsigned long > waits{ 0 };  // messages that had to wait for room in the queue
 
+  static std::atomic< Site* > sites;
+
+  bool admit( Site&, unsigned long& suppressed );
+  void run();
+  void reportSuppressed();
 };
 
+// Logs a printf style message at a level, e.g. GBE_LOG( warn, "bad address %04x", address ).
+// Levels below GBE_LOG_LEVEL are compiled out.
+#define GBE_LOG( level, ... )                                       \
+  do {                                                              \
+    if constexpr( Log::level >= Log::minimum ) {                    \
+      static Log::Site logSite_{ __FILE__, __LINE__ };              \
+      _log->write( logSite_, Log::level, __VA_ARGS__ );             \
+    }                                                               \
+  } while( 0 )
+
 #endif
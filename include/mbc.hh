@@ -3,10 +3,16 @@
 
 #include "common.hh"
 
+#include "state.hh"
+
 class MBC {
 public:
-  virtual u16 getCartAddress( u16 ) = 0;
+  virtual u32 getCartAddress( u16 ) = 0;
   virtual void write( u16, u8 ) = 0;
+
+  // Bank registers, for MBCs that have any
+  virtual void save( StateWriter& ) const {}
+  virtual void load( StateReader& ) {}
 };
 
 #endif
@@ -5,9 +5,12 @@
 
 class MBC1 : public MBC {
 public:
-  u16 getCartAddress( u16 );
+  u32 getCartAddress( u16 );
   void write( u16, u8 );
 
+  void save( StateWriter& state ) const override { state.put( bank ); }
+  void load( StateReader& state ) override { state.get( bank ); }
+
 private:
   int bank = 1;
 };
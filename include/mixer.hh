@@ -0,0 +1,55 @@
+#ifndef __mixer_hh__
+#define __mixer_hh__
+
+#include <cstddef>
+#include <vector>
+
+#include "common.hh"
+
+#include "resampler.hh"
+
+// Turns a frame of the four APU channels into 48 kHz stereo.  The channels are panned and
+// scaled by NR51/NR50 and summed into left and right at the synthesis rate, then each side
+// goes through a polyphase Resampler.  Both steps work on whole frame-sized blocks.
+//
+// The SIMD kernels are used by default; AudioKernels=scalar selects the plain C++ reference
+// versions, which produce bit-identical output.
+class Mixer {
+public:
+  static constexpr int outputRate = 48000;
+
+  // NR50/NR51 as they were from sample start onward
+  struct Segment {
+    std::size_t start;
+    u8 nr50;
+    u8 nr51;
+  };
+
+  Mixer( int inputRate );
+
+  void mix( const std::vector< float > ( &channels )[ 4 ], const std::vector< Segment >& );
+
+  // Interleaved left/right samples produced by the last mix, in the range -1 .. 1
+  const std::vector< float >& output() const { return stereo; }
+
+private:
+  bool reference = false;
+
+  Resampler leftResampler;
+  Resampler rightResampler;
+
+  std::vector< float > left;
+  std::vector< float > right;
+  std::vector< float > leftOut;
+  std::vector< float > rightOut;
+  std::vector< float > stereo;
+
+  static void mixBlock( const float* const channels[ 4 ], std::size_t count,
+                        const float leftGain[ 4 ], const float rightGain[ 4 ],
+                        float* left, float* right );
+  static void mixBlockReference( const float* const channels[ 4 ], std::size_t count,
+                                 const float leftGain[ 4 ], const float rightGain[ 4 ],
+                                 float* left, float* right );
+};
+
+#endif
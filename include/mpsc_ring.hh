@@ -0,0 +1,88 @@
+#ifndef __mpsc_ring_hh__
+#define __mpsc_ring_hh__
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Bounded multi-producer/single-consumer ring buffer.  Any number of threads may push; one
+// thread pops.  Each slot carries a sequence number that says whose turn it is: producers
+// claim a position with a compare-and-swap on the head and publish the slot by bumping its
+// sequence, so a slow producer never exposes a half written slot.  The capacity is rounded
+// up to a power of two.
+template < typename T >
+class MpscRing {
+public:
+  explicit MpscRing( std::size_t capacity ) {
+    std::size_t size = 1;
+    while( size < capacity ) {
+      size <<= 1;
+    }
+
+    slots = std::vector< Slot >( size );
+    for( std::size_t i = 0; i < size; i++ ) {
+      slots[ i ].sequence.store( i, std::memory_order_relaxed );
+    }
+    mask = size - 1;
+  }
+
+  // Producer side.  Calls fill with the claimed slot, in place.  Returns false, without
+  // calling fill, when the ring is full.
+  template < typename F >
+  bool
+  tryPush( F&& fill ) {
+    auto h = head.load( std::memory_order_relaxed );
+
+    for( ;; ) {
+      Slot& slot = slots[ h & mask ];
+      auto sequence = slot.sequence.load( std::memory_order_acquire );
+      auto difference = static_cast< std::ptrdiff_t >( sequence - h );
+
+      if( difference == 0 ) {
+        if( head.compare_exchange_weak( h, h + 1, std::memory_order_relaxed ) ) {
+          fill( slot.item );
+          slot.sequence.store( h + 1, std::memory_order_release );
+          return true;
+        }
+        // h now holds the current head; try again
+      }
+      else if( difference < 0 ) {
+        return false;
+      }
+      else {
+        h = head.load( std::memory_order_relaxed );
+      }
+    }
+  }
+
+  // Consumer side.  Gives direct access to the oldest item; call release() when done.
+  T*
+  front() {
+    Slot& slot = slots[ tail & mask ];
+    if( slot.sequence.load( std::memory_order_acquire ) != tail + 1 ) {
+      return nullptr;
+    }
+
+    return &slot.item;
+  }
+
+  void
+  release() {
+    slots[ tail & mask ].sequence.store( tail + mask + 1, std::memory_order_release );
+    tail++;
+  }
+
+private:
+  struct Slot {
+    std::atomic< std::size_t > sequence;
+    T item;
+  };
+
+  std::vector< Slot > slots;
+  std::size_t mask;
+
+  alignas( 64 ) std::atomic< std::size_t > head{ 0 };
+  alignas( 64 ) std::size_t tail = 0;  // only the consumer touches it
+};
+
+#endif
@@ -5,7 +5,7 @@
 
 class NoMBC : public MBC {
 public:
-  u16 getCartAddress( u16 );
+  u32 getCartAddress( u16 );
   void write( u16, u8 );
 };
 
@@ -0,0 +1,94 @@
+#ifndef __ppu_hh__
+#define __ppu_hh__
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "common.hh"
+
+#include "renderer.hh"
+#include "spsc_ring.hh"
+
+class CPU;
+class RAM;
+class Bus;
+class FrameDump;
+class StateReader;
+class StateWriter;
+
+// Picture processing unit.  Keeps the LY/STAT timing model (456 dots per line, 154 lines
+// per frame) on the emulation thread so reads of LY and STAT are always exact, and raises
+// the VBlank and STAT interrupts.  Pixels come from the Renderer.
+//
+// By default each line is rendered as mode 3 ends.  With PPUThread=true, writes to VRAM,
+// OAM and the LCD registers are logged with the dot they happened on, and the log for a
+// whole frame is handed to a worker thread at VBlank.  The worker replays the writes in
+// between drawing lines, so it produces the same picture one frame behind the emulator.
+class PPU {
+public:
+  ~PPU();
+
+  enum Mode {
+    HBlank  = 0,
+    VBlank  = 1,
+    OAMScan = 2,
+    Drawing = 3
+  };
+
+  void initialize( CPU*, RAM*, Bus*, FrameDump* );
+  void _clock();
+  void setLCDC( u8 );
+
+  // A write to VRAM, OAM or one of the LCD registers the renderer uses
+  void write( u16, u8 );
+
+  // With PPUThread=true these wait for the worker to finish the frames it has been given
+  void save( StateWriter& );
+  void load( StateReader& );
+  void setMuted( bool );
+
+private:
+  CPU* cpu;
+  RAM* ram;
+  Bus* bus;
+
+  static constexpr int dotsPerLine = 456;
+  static constexpr int linesPerFrame = 154;
+  static constexpr int oamScanDots = 80;
+  static constexpr int drawingDots = 172;
+  static constexpr int vblankDots = ( linesPerFrame - Renderer::Height ) * dotsPerLine;
+
+  bool enabled = false;
+  bool stubLY = false;  // gameboy doctor expects LY to always read 0x90
+  int dot = 0;
+  u8 ly = 0;
+  Mode mode = HBlank;
+  bool statLine = false;
+
+  Renderer renderer;
+
+  struct WriteEvent {
+    u32 when;  // dots since the start of the VBlank before the frame
+    u16 address;
+    u8 data;
+  };
+
+  bool threaded = false;
+  u32 frameClock = 0;
+  std::vector< WriteEvent > writeLog;
+  std::unique_ptr< SpscRing< std::vector< WriteEvent > > > frames;
+  std::thread worker;
+  std::atomic< bool > done{ false };
+
+  void setMode( Mode );
+  void setLY( u8 );
+  void updateStat();
+  void endFrame();
+  void run();
+  void renderFrame( const std::vector< WriteEvent >& );
+  void drain();
+};
+
+#endif
@@ -75,22 +75,70 @@
 // $FF4B	  WX	    Window X position plus 7	R/W
 
 class Bus;
-
+class StateReader;
+class StateWriter;
+
+// Reads and writes go through a table of 256-byte pages.  Pages that are plain memory point
+// straight at their backing store, so the common case is a single pointer load.  Pages that
+// need extra work (cartridge bank switching, OAM and the unusable area, cartridge space the
+// ROM doesn't fill) are null and take the slow path.
+//
+// The PPU locks VRAM during mode 3 and OAM during modes 2 and 3 by swapping the VRAM pages
+// to a page that reads 0xff and swallows writes, and by flagging OAM for the slow path.
+// This only happens at mode transitions, not on every access.
 class RAM {
 public:
 
   RAM();
 
-  u8 read8( u16 );
-  void write( u16, u8 );
-  void dbgWrite( u16, u8 );
+  inline u8
+  read8( u16 address ) {
+    auto page = readPage[ address >> 8 ];
+    if( page != nullptr ) {
+      return page[ address & 0xff ];
+    }
+    return slowRead8( address );
+  }
+
+  inline void
+  write( u16 address, u8 data ) {
+    auto page = writePage[ address >> 8 ];
+    if( page != nullptr ) {
+      page[ address & 0xff ] = data;
+      return;
+    }
+    slowWrite( address, data );
+  }
+
+  // Uses image as the cartridge ROM, with MBC1 style bank switching
+  void loadImage( std::vector< char > image );
+
+  void lockVRAM( bool );
+  void lockOAM( bool );
+  bool isVRAMLocked() { return vramLocked; }
+  bool isOAMLocked() { return oamLocked; }
 
   void setBus( Bus* );
 
   std::string hexDump( u16, u16 );
 
+  // What is stored at address, for dumps and debuggers: ignores the PPU's locks and doesn't
+  // log reads of the unusable area
+  u8 peek( u16 address );
+  void poke( u16 address, u8 data );  // not for the cartridge ROM
+
   void changeBank( u16 );
 
+  // Everything but the cartridge ROM
+  void save( StateWriter& ) const;
+  void load( StateReader& );
+
+  // The global checksum and header checksum from the cartridge header, to tell carts apart
+  u32 cartId() const;
+
+  // ROM bank mapped at 0x4000
+  u8 romBank() { return mbc ? mbc->getCartAddress( 0x4000 ) / 0x4000 : 1; }
+
   enum banks {
     Bank0 = 0x3fff,
     BankN = 0x7fff,
@@ -101,7 +149,21 @@ private :
   std::vector< char > _cart;
   Bus* _bus;
 
-  u16 maxCartRom = 0xfdff;
+  u16 maxCartRom = 0x7fff;
+
+  u8* readPage[ 256 ] = { nullptr };
+  u8* writePage[ 256 ] = { nullptr };
+
+  u8 lockedPage[ 256 ];   // what the CPU reads from locked VRAM
+  u8 discardPage[ 256 ];  // where writes to locked VRAM go
+
+  bool vramLocked = false;
+  bool oamLocked = false;
+
+  u8 slowRead8( u16 );
+  void slowWrite( u16, u8 );
+  void mapPages();
+  void mapCartBanks();
 
   std::shared_ptr< MBC >mbc;
 
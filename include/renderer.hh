@@ -0,0 +1,88 @@
+#ifndef __renderer_hh__
+#define __renderer_hh__
+
+#include <array>
+
+#include "common.hh"
+
+class FrameDump;
+class StateReader;
+class StateWriter;
+
+// Draws scanlines from its own copy of VRAM, OAM and the LCD registers.  The PPU feeds it
+// every write that can change the picture, either as it happens or, when rendering runs on
+// a worker thread, as a timestamped log replayed one frame behind the emulator.  Because
+// the renderer never looks at RAM it can run on any thread.
+//
+// Writes that change a value bump version counters (tile data, each tile map row, OAM,
+// registers).  Every rendered line is stamped with the versions it depended on; when a
+// line's stamp is unchanged on the next frame the pixels already in the frame buffer are
+// reused instead of rendering the line again.
+class Renderer {
+public:
+  static constexpr int Width = 160;
+  static constexpr int Height = 144;
+
+  // Each pixel holds a DMG shade, 0 (white) to 3 (black), after the palette is applied
+  using Frame = std::array< u8, Width * Height >;
+
+  void initialize( FrameDump* );
+
+  // Addresses are VRAM (8000-9FFF), OAM (FE00-FE9F) or one of the LCD registers
+  void write( u16, u8 );
+  void renderLine( int );
+  void finishFrame();
+
+  // While muted finished frames are dropped instead of going to the FrameDump
+  void setMuted( bool muted ) { this->muted = muted; }
+
+  // Its copy of VRAM, OAM and the registers, and the frame being drawn
+  void save( StateWriter& ) const;
+  void load( StateReader& );
+
+private:
+  FrameDump* frameDump;
+  bool muted = false;
+
+  u8 vram[ 0x2000 ] = { 0 };
+  u8 oam[ 0xa0 ] = { 0 };
+  u8 lcdc = 0;
+  u8 scy = 0;
+  u8 scx = 0;
+  u8 wy = 0;
+  u8 wx = 0;
+  u8 bgp = 0;
+  u8 obp[ 2 ] = { 0 };
+
+  int windowLine = 0;
+
+  Frame frame{};
+  u64 frameHash = 0;
+  u64 lastFrameHash = 0;
+  u64 frameNumber = 0;
+
+  u32 tileDataVersion = 1;
+  u32 mapRowVersion[ 2 ][ 32 ] = {};
+  u32 oamVersion = 1;
+  u32 registerVersion = 1;
+
+  struct LineStamp {
+    u32 registers;
+    u32 tileData;
+    u32 oam;
+    u32 bgRow;
+    u32 windowRow;
+    int windowLine;  // -1 when the window is not on this line
+
+    bool operator==( const LineStamp& ) const;
+  };
+
+  LineStamp lineStamps[ Height ] = {};  // registers == 0 means never rendered
+  u64 lineHashes[ Height ] = {};
+
+  u8 vram8( u16 address ) { return vram[ address - 0x8000 ]; }
+  int tileRow( u16, u8, u8 );
+  void setRegister( u8&, u8 );
+};
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef __resampler_hh__
+#define __resampler_hh__
+
+#include <cstddef>
+#include <vector>
+
+#include "common.hh"
+
+// Polyphase FIR sample rate converter for one channel.  The rate ratio is reduced to
+// outRate / inRate = L / M; conceptually the input is upsampled by L, low-pass filtered and
+// decimated by M, but only the L phases of the filter that land on an output sample are
+// ever evaluated.  Each phase is a row of taps coefficients stored contiguously so one
+// output sample is a single dot product.
+//
+// Input is consumed in blocks of any size; the samples the filter still needs are kept
+// between calls.
+class Resampler {
+public:
+  static constexpr int taps = 32;
+
+  Resampler( int inRate, int outRate );
+
+  // Filters in[ 0 .. count ) and appends the output samples to out.  When reference is
+  // true the plain C++ dot product is used instead of the SIMD one; both give bit-identical
+  // results.
+  void process( const float* in, std::size_t count, std::vector< float >& out, bool reference );
+
+private:
+  int L;
+  int M;
+  int phase = 0;  // position of the next output between two input samples, in 1/L steps
+
+  std::vector< float > table;    // L rows of taps coefficients
+  std::vector< float > pending;  // input not yet fully consumed by the filter
+
+  static float dot( const float* x, const float* h );
+  static float dotReference( const float* x, const float* h );
+};
+
+#endif
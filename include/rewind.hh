@@ -0,0 +1,75 @@
+#ifndef __rewind_hh__
+#define __rewind_hh__
+
+#include <deque>
+#include <vector>
+
+#include "common.hh"
+
+class Board;
+
+// Reverse step and reverse continue for the debugger.  Every Rewind T-cycles the whole
+// board is saved at the next instruction boundary, and the oldest snapshots are dropped
+// once they take more than RewindBudget MiB.  Going back restores the newest snapshot
+// before the current instruction and runs forward from it, with tracing and breakpoints
+// held off, to find the instruction to stop at; since the emulator is deterministic the run
+// ends up exactly where the original one was at that point.  Snapshots after it are
+// dropped, because the debugger may change what happens next.
+//
+// Nothing leaves the emulator while it runs forward: the serial log, the serial oracle,
+// frames, audio, traces and saved states are held off, as the Board and CPU are replaying.
+// A link cable can't be replayed, so Rewind refuses to run with one.
+//
+// Config keys:
+//   Rewind        T-cycles between snapshots; without it the debugger can't go backwards
+//   RewindBudget  MiB the snapshots may use, defaults to 64
+class Rewind {
+public:
+  enum Kind {
+    step,          // to the instruction before this one
+    toBreakpoint   // to the last breakpoint hit before this instruction
+  };
+
+  // The debugger throws this to leave the current instruction; Board::_clock catches it
+  struct Request {
+    Kind kind;
+  };
+
+  Rewind();
+
+  void initialize( Board* );
+
+  bool isEnabled() const { return interval > 0; }
+
+  // Board::_clock calls snapshot once the CPU has run this far
+  u64 nextSnapshot() const { return next; }
+
+  // Saves the board if the CPU is at an instruction boundary, otherwise waits for one
+  void snapshot();
+
+  // True if there is a snapshot to go back to from the instruction being fetched
+  bool canReverse() const;
+
+  // Called with the CPU in the middle of the fetch the request came from
+  void reverse( Kind );
+
+private:
+  struct Snapshot {
+    u64 tick;
+    std::vector< u8 > state;
+  };
+
+  Board* board = nullptr;
+
+  u64 interval = 0;
+  std::size_t budget = 64 << 20;
+  std::size_t used = 0;
+  u64 next = UINT64_MAX;
+
+  std::deque< Snapshot > snapshots;
+  std::vector< u8 > spare;  // a dropped snapshot's buffer, reused for the next one
+
+  void runFrom( std::size_t index, u64 until, std::vector< u64 >* log, bool everyFetch );
+};
+
+#endif
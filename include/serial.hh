@@ -1,24 +1,102 @@
 #ifndef __serial_hh__
 #define __serial_hh__
 
+#include <cstdint>
 #include <fstream>
+#include <memory>
 
 #include "common.hh"
 
+#include "link.hh"
+#include "serialoracle.hh"
+
 class Bus;
+class CPU;
+class RAM;
+class StateReader;
+class StateWriter;
 
+// Serial port.  A transfer on the internal clock takes 4096 T-cycles (8 bits at 8192 Hz);
+// when it finishes SB holds the byte shifted in, bit 7 of SC is cleared and the serial
+// interrupt is requested.  Without a link cable the byte shifted in is 0xff.
+//
+// With a link cable (LinkSocket, or a LocalLink through setLink) the two emulators run in
+// lockstep windows of LinkWindow T-cycles and swap a LinkMessage at the end of each one;
+// see link.hh.  A transfer on the external clock completes when the peer clocks one.
+//
+// Every byte sent also goes to the SerialOracle, which can end the run.
+//
+// Config keys:
+//   SerialLog   file every byte sent is appended to
+//   LinkSocket  Unix socket path of the link cable
+//   LinkMode    listen (create the socket) or connect (the default)
+//   LinkWindow  T-cycles between syncs, at most 4095 (under one byte); defaults to 2048
 struct Serial {
 
   Serial();
-  
-  void initialize( Bus* bus );
 
+  void initialize( CPU*, RAM*, Bus* );
+
+  // Called every T-cycle with the number of cycles executed so far
+  inline void
+  _clock( u64 ticks ) {
+    if( ticks >= nextEvent ) {
+      event( ticks );
+    }
+  }
+
+  // SC was written
   void write();
 
+  // The transfer in flight and the event times; not the link cable or the oracle
+  void save( StateWriter& ) const;
+  void load( StateReader& );
+
+  // Plugs in a link cable the Serial doesn't own, syncing every window T-cycles
+  void setLink( LinkPort*, u32 window );
+  bool isLinked() const { return link != nullptr; }
+
+  // While muted bytes sent aren't written to the serial log or given to the oracle
+  void setMuted( bool muted ) { this->muted = muted; }
+
+  // True once the oracle has a verdict or the cycle budget has run out
+  bool isFinished() const { return oracle.verdict() != SerialOracle::running; }
+  const SerialOracle& getOracle() const { return oracle; }
+
+  static constexpr u32 byteCycles = 4096;
+
+  // A transfer started in a window must still be in flight when the window ends
+  static constexpr u32 maxWindow = byteCycles - 1;
+
 private:
+  CPU* cpu;
+  RAM* ram;
   Bus* bus;
   std::ofstream os;
+  bool muted = false;
+
+  std::unique_ptr< LinkPort > socketLink;
+  LinkPort* link = nullptr;
+  u32 window = 2048;
+  u64 windowEnd = UINT64_MAX;
+
+  // The transfer in flight, on either clock
+  bool transferring = false;
+  u64 transferEnd = UINT64_MAX;
+  u8 incoming = 0xff;
+
+  // A transfer this side started on the internal clock during the current window
+  LinkMessage pending;
+
+  SerialOracle oracle;
+  u64 budgetEnd = UINT64_MAX;
+
+  u64 nextEvent = UINT64_MAX;
 
+  void event( u64 );
+  void sync();
+  void complete();
+  void schedule();
 };
 
 #endif
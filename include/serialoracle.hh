@@ -0,0 +1,66 @@
+#ifndef __serialoracle_hh__
+#define __serialoracle_hh__
+
+#include <string>
+#include <vector>
+
+#include "common.hh"
+
+// Decides when a test ROM that reports over the serial port is done.  Every byte sent is
+// kept in a ring buffer and fed to a matcher for each pass and fail pattern, so a verdict
+// is reached on the byte that completes a pattern without rescanning any output.  A cycle
+// budget ends runs that never report.
+//
+// Config keys:
+//   SerialOracle  true to stop on the patterns below
+//   SerialPass    text that means the test passed, defaults to "Passed"; several can be
+//                 given separated by |
+//   SerialFail    text that means the test failed, defaults to "Failed"
+//   CycleBudget   T-cycles to run before giving up; also works without SerialOracle
+class SerialOracle {
+public:
+  enum Verdict {
+    running,
+    passed,
+    failed,
+    timedOut
+  };
+
+  SerialOracle();
+
+  bool isEnabled() const { return enabled; }
+  Verdict verdict() const { return result; }
+  u64 budget() const { return cycleBudget; }
+
+  void feed( u8 );
+  void timeOut();
+
+  // The last bytes received, oldest first
+  std::string tail() const;
+
+  // Exit status for main: 0 passed, 1 failed, 2 timed out or still running
+  int exitStatus() const;
+
+  static const char* name( Verdict );
+
+private:
+  struct Pattern {
+    std::string text;
+    std::vector< int > fallback;  // KMP failure function
+    int matched = 0;
+    Verdict verdict;
+  };
+
+  bool enabled = false;
+  Verdict result = running;
+  u64 cycleBudget = UINT64_MAX;
+  std::vector< Pattern > patterns;
+
+  static constexpr std::size_t ringSize = 4096;
+  char ring[ ringSize ];
+  u64 received = 0;
+
+  void addPatterns( const std::string&, Verdict );
+};
+
+#endif
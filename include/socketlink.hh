@@ -0,0 +1,35 @@
+#ifndef __socketlink_hh__
+#define __socketlink_hh__
+
+#include <string>
+
+#include "common.hh"
+
+#include "link.hh"
+
+// Link cable to another emulator process over a Unix domain socket.  One side listens on
+// the socket path and the other connects to it; after that the two are symmetric.  They
+// first swap their LinkWindow as 4 bytes, then each window message is a fixed 8 byte record.
+class SocketLink : public LinkPort {
+public:
+  enum Mode {
+    listen,
+    connect
+  };
+
+  // Throws std::runtime_error if the connection can't be made or the peer uses another
+  // window
+  SocketLink( const std::string& path, Mode, u32 window );
+  ~SocketLink();
+
+  bool exchange( const LinkMessage& out, LinkMessage& in ) override;
+
+private:
+  int fd = -1;
+  std::string path;
+  Mode mode;
+
+  void handshake( u32 window );
+};
+
+#endif
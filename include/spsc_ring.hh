@@ -0,0 +1,107 @@
+#ifndef __spsc_ring_hh__
+#define __spsc_ring_hh__
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Bounded single-producer/single-consumer ring buffer.  One thread may call tryPush and
+// another may call tryPop without any locking.  The capacity is rounded up to a power of
+// two so the head and tail counters can run freely and be masked into the slot array.
+template < typename T >
+class SpscRing {
+public:
+  explicit SpscRing( std::size_t capacity ) {
+    std::size_t size = 1;
+    while( size < capacity ) {
+      size <<= 1;
+    }
+
+    slots.resize( size );
+    mask = size - 1;
+  }
+
+  // Producer side.  Returns false, and leaves the ring untouched, when the ring is full.
+  bool
+  tryPush( const T& item ) {
+    auto h = head.load( std::memory_order_relaxed );
+    if( h - tail.load( std::memory_order_acquire ) > mask ) {
+      return false;
+    }
+
+    slots[ h & mask ] = item;
+    head.store( h + 1, std::memory_order_release );
+
+    return true;
+  }
+
+  // Producer side.  Gives direct access to the next free slot so large items can be
+  // filled in place; call commit() once the slot is ready.  Returns nullptr when full.
+  T*
+  reserve() {
+    auto h = head.load( std::memory_order_relaxed );
+    if( h - tail.load( std::memory_order_acquire ) > mask ) {
+      return nullptr;
+    }
+
+    return &slots[ h & mask ];
+  }
+
+  void
+  commit() {
+    head.store( head.load( std::memory_order_relaxed ) + 1, std::memory_order_release );
+  }
+
+  // Consumer side.  Returns false when the ring is empty.
+  bool
+  tryPop( T& item ) {
+    auto t = tail.load( std::memory_order_relaxed );
+    if( t == head.load( std::memory_order_acquire ) ) {
+      return false;
+    }
+
+    item = slots[ t & mask ];
+    tail.store( t + 1, std::memory_order_release );
+
+    return true;
+  }
+
+  // Consumer side.  Gives direct access to the oldest item; call release() when done.
+  T*
+  front() {
+    auto t = tail.load( std::memory_order_relaxed );
+    if( t == head.load( std::memory_order_acquire ) ) {
+      return nullptr;
+    }
+
+    return &slots[ t & mask ];
+  }
+
+  void
+  release() {
+    tail.store( tail.load( std::memory_order_relaxed ) + 1, std::memory_order_release );
+  }
+
+  // Either side.  Only a snapshot while the other side is running.
+  std::size_t
+  size() {
+    return head.load( std::memory_order_acquire ) - tail.load( std::memory_order_acquire );
+  }
+
+  std::size_t capacity() const { return mask + 1; }
+
+  bool
+  empty() {
+    return tail.load( std::memory_order_acquire ) == head.load( std::memory_order_acquire );
+  }
+
+private:
+  std::vector< T > slots;
+  std::size_t mask;
+
+  // Keep the producer and consumer counters on separate cache lines
+  alignas( 64 ) std::atomic< std::size_t > head{ 0 };
+  alignas( 64 ) std::atomic< std::size_t > tail{ 0 };
+};
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef __state_hh__
+#define __state_hh__
+
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "common.hh"
+
+// The state of a Board as a flat run of bytes: a StateHeader, then one section per
+// component, each a SectionHeader followed by the component's fields in a fixed order.
+// Values are copied as they are in memory, so the layout depends on the compiler, the ABI
+// and the byte order; a state is only sure to load in the build that saved it.  put and get
+// take no type with padding, which would copy uninitialized bytes: structs that have some
+// are saved a field at a time.  A loader finds sections by tag, so it can skip ones it
+// doesn't know, and refuses a section whose version it doesn't read.
+
+// Four characters naming a section, e.g. stateTag( "CPU " )
+constexpr u32
+stateTag( const char ( &name )[ 5 ] ) {
+  return static_cast< u32 >( static_cast< u8 >( name[ 0 ] ) ) |
+         static_cast< u32 >( static_cast< u8 >( name[ 1 ] ) ) << 8 |
+         static_cast< u32 >( static_cast< u8 >( name[ 2 ] ) ) << 16 |
+         static_cast< u32 >( static_cast< u8 >( name[ 3 ] ) ) << 24;
+}
+
+struct StateHeader {
+  static constexpr u32 magic = stateTag( "GBES" );
+  static constexpr u32 formatVersion = 1;
+
+  u32 tag;
+  u32 version;
+  u32 cart;       // whatever identifies the cartridge, checked before loading
+  u32 sections;
+};
+
+struct SectionHeader {
+  u32 tag;
+  u32 version;
+  u64 size;  // of what follows this header
+};
+
+class StateWriter {
+public:
+  // Reuses buffer's memory, so saving into the same buffer again doesn't allocate
+  explicit StateWriter( std::vector< u8 >& buffer, u32 cart )
+    : buffer( buffer ) {
+    buffer.clear();
+    put( StateHeader{ StateHeader::magic, StateHeader::formatVersion, cart, 0 } );
+  }
+
+  void
+  beginSection( u32 tag, u32 version ) {
+    sectionStart = buffer.size();
+    put( SectionHeader{ tag, version, 0 } );
+  }
+
+  void
+  endSection() {
+    u64 size = buffer.size() - sectionStart - sizeof( SectionHeader );
+    std::memcpy( buffer.data() + sectionStart + offsetof( SectionHeader, size ), &size, sizeof( size ) );
+
+    u32 sections;
+    std::memcpy( &sections, buffer.data() + offsetof( StateHeader, sections ), sizeof( sections ) );
+    sections++;
+    std::memcpy( buffer.data() + offsetof( StateHeader, sections ), &sections, sizeof( sections ) );
+  }
+
+  void
+  put( const void* data, std::size_t size ) {
+    auto at = buffer.size();
+    buffer.resize( at + size );
+    std::memcpy( buffer.data() + at, data, size );
+  }
+
+  template < typename T >
+  void
+  put( const T& value ) {
+    static_assert( std::is_trivially_copyable_v< T >, "only plain values can be copied" );
+    static_assert( std::has_unique_object_representations_v< T >, "put a padded struct by field" );
+    put( &value, sizeof( T ) );
+  }
+
+  template < typename T >
+  void
+  put( const std::vector< T >& values ) {
+    static_assert( std::is_trivially_copyable_v< T >, "only plain values can be copied" );
+    static_assert( std::has_unique_object_representations_v< T >, "put a padded struct by field" );
+    put( static_cast< u64 >( values.size() ) );
+    put( values.data(), values.size() * sizeof( T ) );
+  }
+
+private:
+  std::vector< u8 >& buffer;
+  std::size_t sectionStart = 0;
+};
+
+class StateReader {
+public:
+  // Throws std::runtime_error if buffer isn't a state this build reads
+  explicit StateReader( const std::vector< u8 >& buffer )
+    : buffer( buffer ), end( buffer.size() ) {
+    get( header );
+    if( header.tag != StateHeader::magic ) {
+      throw std::runtime_error( "Not a saved state" );
+    }
+    if( header.version != StateHeader::formatVersion ) {
+      throw std::runtime_error( "Saved state format " + std::to_string( header.version ) +
+                                " is not supported" );
+    }
+  }
+
+  u32 cart() const { return header.cart; }
+
+  // Moves to the section with this tag and returns its version; reads stop at its end.
+  // Throws std::runtime_error if there is no such section.
+  u32
+  section( u32 tag ) {
+    std::size_t next = sizeof( StateHeader );
+    for( u32 i = 0; i < header.sections; i++ ) {
+      SectionHeader section;
+      at = next;
+      end = buffer.size();
+      get( section );
+      if( section.size > end - at ) {
+        throw std::runtime_error( "Saved state is truncated" );
+      }
+      next = at + section.size;
+      if( section.tag == tag ) {
+        end = next;
+        return section.version;
+      }
+    }
+
+    char name[ 5 ] = { 0 };
+    std::memcpy( name, &tag, 4 );
+    throw std::runtime_error( std::string( "Saved state has no " ) + name + " section" );
+  }
+
+  // Throws std::runtime_error if the section is shorter than what is asked for
+  void
+  get( void* data, std::size_t size ) {
+    if( size > end - at ) {
+      throw std::runtime_error( "Saved state is truncated" );
+    }
+    std::memcpy( data, buffer.data() + at, size );
+    at += size;
+  }
+
+  template < typename T >
+  void
+  get( T& value ) {
+    static_assert( std::is_trivially_copyable_v< T >, "only plain values can be copied" );
+    static_assert( std::has_unique_object_representations_v< T >, "get a padded struct by field" );
+    get( &value, sizeof( T ) );
+  }
+
+  template < typename T >
+  void
+  get( std::vector< T >& values ) {
+    static_assert( std::has_unique_object_representations_v< T >, "get a padded struct by field" );
+    values.resize( getCount( sizeof( T ) ) );
+    get( values.data(), values.size() * sizeof( T ) );
+  }
+
+  // The length put before a run of elements, each at least elementSize bytes.  Throws
+  // std::runtime_error if the section can't hold that many.
+  u64
+  getCount( std::size_t elementSize ) {
+    u64 count;
+    get( count );
+    if( count > ( end - at ) / elementSize ) {
+      throw std::runtime_error( "Saved state is truncated" );
+    }
+    return count;
+  }
+
+private:
+  const std::vector< u8 >& buffer;
+  std::size_t at = 0;
+  std::size_t end;
+  StateHeader header;
+};
+
+#endif
@@ -6,6 +6,8 @@
 class CPU;
 class RAM;
 class Bus;
+class StateReader;
+class StateWriter;
 
 class Timer{
 public:
@@ -14,6 +16,9 @@ public:
   void _clock();
   void setTAC( u8 );
 
+  void save( StateWriter& ) const;
+  void load( StateReader& );
+
   enum ClockSelect {
     mcycle256 = 0,
     mcycle4   = 1,
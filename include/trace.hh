@@ -0,0 +1,195 @@
+#ifndef __trace_hh__
+#define __trace_hh__
+
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common.hh"
+
+#include "spsc_ring.hh"
+
+struct TraceOpcodes;
+class TraceCodec;
+
+// One executed instruction, captured after the fetch and before it runs.  Records are a
+// fixed 32 bytes so a trace can be indexed and written without any formatting; the text
+// layouts are rendered later by gbe-tracedump.  Fields are in host (little endian) order.
+struct TraceRecord {
+  u64 tick;        // CPU::ticks when the instruction was fetched
+  u16 pc;          // address of the opcode
+  u16 nextPC;      // PC after the opcode and its operands were read
+  u16 opcode;      // index into the instruction table; 0x100 is set for CB prefixed ones
+  u16 AF;
+  u16 BC;
+  u16 DE;
+  u16 HL;
+  u16 SP;
+  u8 params[ 2 ];  // operand bytes; only the first bytes - 1 mean anything
+  u8 pcmem[ 4 ];   // memory at pc, as shown by Gameboy Doctor
+  u8 bank;         // ROM bank mapped at 0x4000
+  u8 flags;
+
+  enum Flags {
+    afterGap = 0x01  // records before this one were dropped by the writer
+  };
+};
+
+static_assert( sizeof( TraceRecord ) == 32, "TraceRecord must stay 32 bytes" );
+
+// Start of every binary trace file
+struct TraceHeader {
+  char magic[ 8 ];  // "GBETRACE"
+  u16 version;      // an Encoding
+  u16 recordSize;
+  u32 flags;
+
+  enum Encoding {
+    fixed = 1,  // TraceRecords one after the other
+    delta = 2   // blocks of TraceCodec records
+  };
+
+  enum Flags {
+    gbdoc = 0x01  // the emulator was run with Tracer=GBDoc
+  };
+};
+
+static_assert( sizeof( TraceHeader ) == 16, "TraceHeader must stay 16 bytes" );
+
+// Appends to a file mapped into memory.  The file grows a chunk at a time and is cut back to
+// what was actually written when closed.  A trace from a process that died before that ends
+// in zeroes, which TraceReader stops at.
+class TraceFile {
+public:
+  TraceFile( const std::string& fileName, TraceHeader::Encoding, u32 flags );
+  ~TraceFile();
+
+  inline void
+  append( const void* data, std::size_t size ) {
+    if( used + size > mapped ) {
+      grow();
+    }
+    std::memcpy( base + used, data, size );
+    used += size;
+  }
+
+  // Leaves size zero bytes
+  void skip( std::size_t size );
+
+  std::size_t size() const { return used; }
+
+  // Only valid until the next append or skip
+  char* at( std::size_t offset ) { return base + offset; }
+
+private:
+  static constexpr std::size_t chunkSize = 16 << 20;
+
+  std::string fileName;
+  int fd = -1;
+  char* base = nullptr;
+  std::size_t mapped = 0;
+  std::size_t used = 0;
+
+  void grow();
+};
+
+// Hands records to a worker thread that encodes them and appends them to a TraceFile, so
+// the CPU never touches the file itself.  When the worker can't keep up the policy decides what happens:
+// block waits for room, drop discards the record, and sample discards it and then keeps only
+// one record in sampleRate until the queue is back under half full.  The first record kept
+// after any loss is flagged, and the losses are counted in the log.
+//
+// Config keys:
+//   TracePolicy  block (the default), drop or sample
+//   TraceSample  1 in how many records sample keeps while catching up, defaults to 16
+//
+// The delta encoding needs the instruction table; fixed doesn't look at it.
+class TraceWriter {
+public:
+  enum Policy {
+    block,
+    drop,
+    sample
+  };
+
+  TraceWriter( const std::string& fileName, TraceHeader::Encoding, u32 flags, const TraceOpcodes& );
+  ~TraceWriter();
+
+  inline void
+  submit( const TraceRecord& record ) {
+    submitted++;
+
+    if( !thinning && !lost ) {
+      if( queue.tryPush( record ) ) {
+        return;
+      }
+    }
+    submitSlow( record );
+  }
+
+private:
+  static constexpr std::size_t queueSize = 1 << 16;
+
+  TraceFile file;
+  std::unique_ptr< TraceCodec > codec;  // for the delta encoding
+  std::size_t blockStart = 0;
+  SpscRing< TraceRecord > queue{ queueSize };
+  std::thread worker;
+  std::atomic< bool > done{ false };
+
+  Policy policy = block;
+  u32 sampleRate = 16;
+
+  bool lost = false;      // a record was dropped since the last one queued
+  bool thinning = false;  // sampling while the queue drains
+  u32 sampleCount = 0;
+
+  u64 submitted = 0;
+  u64 dropped = 0;
+  u64 sampledOut = 0;
+  u64 stalls = 0;
+
+  void submitSlow( const TraceRecord& );
+  void run();
+  void encode( const TraceRecord& );
+};
+
+// Reads back a trace in either encoding
+class TraceReader {
+public:
+  TraceReader( const std::string& fileName, const TraceOpcodes& );
+  ~TraceReader();
+
+  const TraceHeader& header() const { return head; }
+
+  // False at the end of the trace
+  bool next( TraceRecord& );
+
+  // Moves to the first record at or after tick.  Fixed traces are searched record by record,
+  // delta traces by the keyframe at the start of each block.
+  void seek( u64 tick );
+
+private:
+  std::ifstream is;
+  TraceHeader head;
+  u64 fileSize = 0;
+
+  std::unique_ptr< TraceCodec > codec;
+  std::vector< u8 > block;
+  u64 blockCount = 0;
+  u64 nextBlock = 0;
+  std::size_t position = 0;
+  std::size_t blockUsed = 0;
+
+  bool held = false;  // seek found a record that next hasn't returned yet
+  TraceRecord heldRecord;
+
+  bool readFixed( u64 index, TraceRecord& );
+  bool loadBlock( u64 index, TraceRecord& keyframe );
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef __tracecodec_hh__
+#define __tracecodec_hh__
+
+#include <cstddef>
+#include <vector>
+
+#include "common.hh"
+
+#include "trace.hh"
+
+// What the codec needs to know about each entry in the instruction table
+struct TraceOpcodes {
+  u8 bytes[ 512 ];
+  u8 cycles[ 512 ];
+};
+
+// Delta encoding for trace records (TraceFormat=delta).  Each record is predicted from the
+// one before it and only what the prediction gets wrong is stored:
+//
+//   tick    the previous tick plus the previous instruction's cycle count
+//   pc      the previous nextPC
+//   nextPC  pc plus the length of the instruction
+//   opcode  the byte at pc, in the CB table when the previous instruction was PREFIX CB
+//   pcmem   whatever was last seen at those addresses, tracked per ROM bank
+//   regs    unchanged
+//
+// A record starts with a byte of mask bits.  Changed registers and a mispredicted pc follow
+// as zigzag varint deltas, a mispredicted tick as a varint delta.  Anything else goes in an
+// extra byte of mask bits followed by the raw values.  A typical record is 2 to 4 bytes.
+//
+// The file is cut into blocks that each start with a full record, so a reader can start
+// decoding at any block.
+class TraceCodec {
+public:
+  static constexpr std::size_t blockSize = 64 << 10;
+  static constexpr std::size_t blockHeaderSize = 4 + sizeof( TraceRecord );  // bytes used, keyframe
+  static constexpr std::size_t maxEncodedSize = 48;
+
+  explicit TraceCodec( const TraceOpcodes& );
+
+  // Starts a block with record as its keyframe
+  void reset( const TraceRecord& );
+
+  // Both return the number of bytes written or read
+  std::size_t encode( const TraceRecord&, u8* );
+  std::size_t decode( const u8*, TraceRecord& );
+
+private:
+  enum Mask {
+    changedAF = 0x01,
+    changedBC = 0x02,
+    changedDE = 0x04,
+    changedHL = 0x08,
+    changedSP = 0x10,
+    changedTick = 0x20,
+    hasExtra = 0x40,
+    changedPC = 0x80
+  };
+
+  enum Extra {
+    changedPCMEM = 0x0f,  // one bit per byte
+    changedBank = 0x10,
+    hasFlags = 0x20,
+    changedOpcode = 0x40,
+    changedNextPC = 0x80
+  };
+
+  TraceOpcodes opcodes;
+  TraceRecord previous;
+
+  // The last byte seen at each address, with 0x4000 - 0x7fff kept per bank.  Only the
+  // entries set since the last keyframe are cleared for the next one.
+  std::vector< u8 > shadow;
+  std::vector< u32 > touched;
+
+  u32 shadowIndex( u16 address, u8 bank );
+  void remember( const TraceRecord& );
+  u16 predictOpcode( u8 );
+};
+
+#endif
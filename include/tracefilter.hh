@@ -0,0 +1,80 @@
+#ifndef __tracefilter_hh__
+#define __tracefilter_hh__
+
+#include <string>
+
+#include "common.hh"
+
+class Bus;
+
+// Decides which instructions TraceLog records.  The PC ranges are turned into a table of
+// 256-byte pages that are entirely in, entirely out or mixed, backed by one bit per address
+// for the mixed ones, so an instruction outside the ranges costs a table lookup.
+//
+// Config keys (addresses in hex, ticks in decimal):
+//   TracePC       ranges to trace, e.g. 0150-01ff,c000-c0ff; a single address is allowed
+//   TraceBank     only trace 0x4000 - 0x7fff while this ROM bank is mapped there; on its
+//                 own it traces just that bank
+//   TraceStart    first tick to trace
+//   TraceStop     tick to stop tracing at
+//   TraceAfterPC  start tracing the first time this address executes
+//   TraceEvery    trace 1 in N of the instructions the other keys let through
+class TraceFilter {
+public:
+  TraceFilter();
+
+  void initialize( Bus* );
+
+  bool isEnabled() const { return enabled; }
+
+  inline bool
+  accept( u16 pc, u64 tick ) {
+    if( tick < startTick || tick >= stopTick ) {
+      return false;
+    }
+
+    if( !armed ) {
+      if( pc != armPC ) {
+        return false;
+      }
+      armed = true;
+    }
+
+    u8 page = pages[ pc >> 8 ];
+    if( page == none || ( page == mixed && ( ( bits[ pc >> 6 ] >> ( pc & 63 ) ) & 1 ) == 0 ) ) {
+      return false;
+    }
+
+    return !slowChecks || acceptSlow( pc );
+  }
+
+private:
+  enum Page : u8 {
+    none,
+    all,
+    mixed
+  };
+
+  bool enabled = false;
+  Bus* bus = nullptr;
+
+  u64 startTick = 0;
+  u64 stopTick = UINT64_MAX;
+
+  bool armed = true;
+  u16 armPC = 0;
+
+  Page pages[ 256 ];
+  u64 bits[ 1024 ];
+
+  bool slowChecks = false;  // bank or sampling
+  int bank = -1;
+  u64 every = 1;
+  u64 count = 0;
+
+  void addRange( u16 first, u16 last );
+  void parseRanges( const std::string& );
+  bool acceptSlow( u16 pc );
+};
+
+#endif
@@ -209,7 +209,7 @@
 { 0x0d0, "RET NC"      , &CPU::RET, am_ins   , 1, 20,  8, '-', '-', '-', '-' },
 { 0x0d1, "POP DE"      , &CPU::POP, am_ins   , 1, 12,  0, '-', '-', '-', '-' },
 { 0x0d2, "JP NC,a16"   , &CPU::JP, am_a16    , 3, 16, 12, '-', '-', '-', '-' },
-{ 0x0d3, "DBG"         , &CPU::DBG, am_ins   , 1,  4,  0, '-', '-', '-', '-' },
+{ 0x0d3, "illegal"     , &CPU::ILL, am_ins   , 1,  1,  0, '-', '-', '-', '-' },
 { 0x0d4, "CALL NC,a16" , &CPU::CALL, am_a16  , 3, 24, 12, '-', '-', '-', '-' },
 { 0x0d5, "PUSH DE"     , &CPU::PUSH, am_ins  , 1, 16,  0, '-', '-', '-', '-' },
 { 0x0d6, "SUB d8"      , &CPU::SUB, am_d8    , 2,  8,  0, 'Z', '1', 'H', 'C' },
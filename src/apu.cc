@@ -0,0 +1,643 @@
+#include <algorithm>
+
+#include "../include/apu.hh"
+
+#include "../include/audiolog.hh"
+#include "../include/bus.hh"
+#include "../include/cpu.hh"
+#include "../include/ram.hh"
+#include "../include/state.hh"
+
+// Sound registers are laid out five per channel starting at NR10, so for $FF10-$FF23
+// channel = offset / 5 and register = offset % 5 (NR20 and NR40 don't exist).
+//
+//         NRx0        NRx1            NRx2          NRx3        NRx4
+// Square1 sweep       duty, length    envelope      period lo   period hi, control
+// Square2 -           duty, length    envelope      period lo   period hi, control
+// Wave    DAC enable  length          output level  period lo   period hi, control
+// Noise   -           length          envelope      LFSR        control
+
+static const u8 dutyTable[ 4 ][ 8 ] = {
+  { 0, 0, 0, 0, 0, 0, 0, 1 },  // 12.5%
+  { 1, 0, 0, 0, 0, 0, 0, 1 },  // 25%
+  { 1, 0, 0, 0, 0, 1, 1, 1 },  // 50%
+  { 0, 1, 1, 1, 1, 1, 1, 0 },  // 75%
+};
+
+// Bits that always read back as 1, NR10 through NR52.  Write-only bits read as 1 too.
+static const u8 readMask[ 23 ] = {
+  0x80, 0x3f, 0x00, 0xff, 0xbf,  // NR10-NR14
+  0xff, 0x3f, 0x00, 0xff, 0xbf,  // NR20-NR24
+  0x7f, 0xff, 0x9f, 0xff, 0xbf,  // NR30-NR34
+  0xff, 0xff, 0x00, 0x00, 0xbf,  // NR40-NR44
+  0x00, 0x00, 0x70,              // NR50-NR52
+};
+
+APU::APU() {
+  silent = conf->GetValue( "AudioMode" ) == "silent";
+
+  if( silent ) {
+    // Nothing happens at the end of a frame; reads and writes catch up on their own
+    frameEnd = UINT64_MAX;
+    return;
+  }
+
+  for( auto& s : samples ) {
+    s.reserve( frameLength / BlipBuffer::clocksPerSample + 1 );
+  }
+  segments.push_back( { 0, nr50, nr51 } );
+}
+
+void
+APU::initialize( CPU* cpu, RAM* ram, AudioLog* audioLog ) {
+  this->cpu = cpu;
+  this->ram = ram;
+  this->audioLog = audioLog;
+
+  if( silent && audioLog->isEnabled() ) {
+    _log->Write( Log::warn, "AudioMode=silent produces no samples, the audio log will be empty" );
+  }
+}
+
+u8
+APU::read( u16 address ) {
+  u64 now = cpu->ticks;
+
+  if( silent ) {
+    catchUpSequencer( now );
+  }
+  else {
+    while( now >= frameEnd ) {
+      endFrame();
+    }
+    advance( now - frameStart );
+  }
+
+  if( address == Bus::IOAddress::NR52 ) {
+    u8 active = 0;
+    for( int ch = 0; ch < 4; ch++ ) {
+      if( channels[ ch ].enabled ) {
+        active |= 1 << ch;
+      }
+    }
+    return ( power ? 0x80 : 0 ) | readMask[ address - Bus::IOAddress::NR10 ] | active;
+  }
+
+  if( address < Bus::IOAddress::WAVE_START ) {
+    // Registers are cleared while the APU is off; the unused addresses always read 0xff
+    u8 mask = address < Bus::IOAddress::NR52 ? readMask[ address - Bus::IOAddress::NR10 ] : 0xff;
+    return mask | ( power ? ram->read8( address ) : 0 );
+  }
+
+  return ram->read8( address );
+}
+
+void
+APU::write( u16 address, u8 data ) {
+  u64 now = cpu->ticks;
+
+  if( silent ) {
+    catchUpSequencer( now );
+    apply( { 0, address, data } );
+    return;
+  }
+
+  while( now >= frameEnd ) {
+    endFrame();
+  }
+
+  writeLog.push_back( { static_cast< u32 >( now - frameStart ), address, data } );
+}
+
+// Synthesizes the frame that just finished.
+void
+APU::endFrame() {
+  u32 length = frameEnd - frameStart;
+
+  advance( length );
+
+  for( int ch = 0; ch < 4; ch++ ) {
+    samples[ ch ].clear();
+    blips[ ch ].endFrame( length, samples[ ch ] );
+  }
+
+  mixer.mix( samples, segments );
+  if( !muted ) {
+    audioLog->submit( mixer.output() );
+  }
+
+  segments.clear();
+  segments.push_back( { 0, nr50, nr51 } );
+
+  writeLog.clear();
+  nextWrite = 0;
+  cursor = 0;
+  frameStart = frameEnd;
+  frameEnd += frameLength;
+}
+
+// Walks the register writes and frame sequencer steps before T-cycle until of the frame in
+// time order, letting every channel run up to each event before applying it.
+void
+APU::advance( u32 until ) {
+  for( ;; ) {
+    enum { none, sequencer, registerWrite } kind = none;
+    u32 time = until;
+
+    if( sequencerNext - frameStart < time ) {
+      time = sequencerNext - frameStart;
+      kind = sequencer;
+    }
+    if( nextWrite < writeLog.size() && writeLog[ nextWrite ].time < time ) {
+      time = writeLog[ nextWrite ].time;
+      kind = registerWrite;
+    }
+
+    for( int ch = 0; ch < 4; ch++ ) {
+      run( ch, cursor, time );
+    }
+    cursor = time;
+
+    if( kind == none ) {
+      break;
+    }
+    else if( kind == sequencer ) {
+      stepSequencer();
+      sequencerNext += 8192;
+    }
+    else {
+      apply( writeLog[ nextWrite++ ] );
+
+      if( nr50 != segments.back().nr50 || nr51 != segments.back().nr51 ) {
+        std::size_t start = time / BlipBuffer::clocksPerSample;
+        if( start == segments.back().start ) {
+          segments.back() = { start, nr50, nr51 };
+        }
+        else {
+          segments.push_back( { start, nr50, nr51 } );
+        }
+      }
+    }
+  }
+}
+
+// Silent mode: runs the frame sequencer steps due by now.  Stretches where no step can
+// change anything are skipped in one go.
+void
+APU::catchUpSequencer( u64 now ) {
+  while( sequencerNext <= now ) {
+    if( sequencerIdle() ) {
+      u64 steps = ( now - sequencerNext ) / 8192 + 1;
+      sequencerStep = ( sequencerStep + steps ) & 7;
+      sequencerNext += steps * 8192;
+      return;
+    }
+
+    stepSequencer();
+    sequencerNext += 8192;
+  }
+}
+
+// True when no length counter, envelope or sweep has anything left to do
+bool
+APU::sequencerIdle() {
+  if( !power ) {
+    return true;
+  }
+
+  for( auto& c : channels ) {
+    if( c.lengthEnabled && c.length > 0 ) {
+      return false;
+    }
+    if( c.enabled && c.envelopePeriod > 0 ) {
+      return false;
+    }
+  }
+
+  return !( sweepEnabled && channels[ 0 ].enabled );
+}
+
+int
+APU::period( int ch ) {
+  switch( ch ) {
+  case 0:
+  case 1:
+    return ( 2048 - channels[ ch ].frequency ) * 4;
+  case 2:
+    return ( 2048 - channels[ ch ].frequency ) * 2;
+  default:
+    return ( noiseDivisor == 0 ? 8 : noiseDivisor * 16 ) << noiseShift;
+  }
+}
+
+int
+APU::output( int ch ) {
+  Channel& c = channels[ ch ];
+
+  if( !c.enabled || !c.dacEnabled ) {
+    return 0;
+  }
+
+  switch( ch ) {
+  case 0:
+  case 1:
+    return dutyTable[ c.duty ][ c.position ] ? c.volume : -c.volume;
+  case 2: {
+    u8 sample = waveRAM[ c.position / 2 ];
+    sample = ( c.position & 1 ) ? sample & 0xf : sample >> 4;
+    return ( sample >> waveVolumeShift ) * 2 - ( 15 >> waveVolumeShift );
+  }
+  default:
+    return ( lfsr & 1 ) ? -c.volume : c.volume;
+  }
+}
+
+// Advances one channel from time from to time to (T-cycles within the frame), adding a step
+// to its blip buffer every time its output level changes.
+void
+APU::run( int ch, u32 from, u32 to ) {
+  Channel& c = channels[ ch ];
+
+  auto setLevel = [ & ]( u32 time ) {
+    int level = output( ch );
+    if( level != c.level ) {
+      blips[ ch ].addDelta( time, level - c.level );
+      c.level = level;
+    }
+  };
+
+  setLevel( from );
+
+  if( !c.enabled ) {
+    return;
+  }
+
+  u32 time = from;
+  int stepLength = period( ch );
+
+  // A square or wave channel that can't be heard only needs its position kept up to date
+  bool silent = ( ch < 2 && c.volume == 0 ) || ( ch == 2 && waveVolumeShift == 4 );
+  if( silent ) {
+    if( time + c.timer <= to ) {
+      u32 remaining = to - time - c.timer;
+      int steps = 1 + remaining / stepLength;
+      c.position = ( c.position + steps ) % ( ch == 2 ? 32 : 8 );
+      c.timer = stepLength - remaining % stepLength;
+    }
+    else {
+      c.timer -= to - time;
+    }
+    return;
+  }
+
+  while( time + c.timer <= to ) {
+    time += c.timer;
+    c.timer = stepLength;
+
+    if( ch < 2 ) {
+      c.position = ( c.position + 1 ) & 7;
+    }
+    else if( ch == 2 ) {
+      c.position = ( c.position + 1 ) & 31;
+    }
+    else {
+      u16 bit = ( lfsr ^ ( lfsr >> 1 ) ) & 1;
+      lfsr = ( lfsr >> 1 ) | ( bit << 14 );
+      if( noiseWidth7 ) {
+        lfsr = ( lfsr & ~0x40 ) | ( bit << 6 );
+      }
+    }
+
+    setLevel( time );
+  }
+
+  c.timer -= to - time;
+}
+
+void
+APU::apply( const RegisterWrite& w ) {
+  u16 address = w.address;
+  u8 data = w.data;
+
+  if( Bus::IOAddress::WAVE_START <= address && address <= Bus::IOAddress::WAVE_END ) {
+    waveRAM[ address - Bus::IOAddress::WAVE_START ] = data;
+    return;
+  }
+
+  if( address == Bus::IOAddress::NR52 ) {
+    bool on = ( data & 0x80 ) > 0;
+    if( power && !on ) {
+      powerOff();
+    }
+    else if( !power && on ) {
+      sequencerStep = 0;
+    }
+    power = on;
+    return;
+  }
+
+  // While the APU is off its registers can't be written
+  if( !power || address > Bus::IOAddress::NR51 ) {
+    return;
+  }
+
+  if( address == Bus::IOAddress::NR50 ) {
+    nr50 = data;
+    return;
+  }
+  if( address == Bus::IOAddress::NR51 ) {
+    nr51 = data;
+    return;
+  }
+
+  int offset = address - Bus::IOAddress::NR10;
+  int ch = offset / 5;
+  Channel& c = channels[ ch ];
+
+  switch( offset % 5 ) {
+  case 0:
+    if( ch == 0 ) {
+      sweepPeriod = ( data >> 4 ) & 0x7;
+      sweepNegate = ( data & 0x08 ) > 0;
+      sweepShift = data & 0x7;
+    }
+    else if( ch == 2 ) {
+      c.dacEnabled = ( data & 0x80 ) > 0;
+      if( !c.dacEnabled ) {
+        c.enabled = false;
+      }
+    }
+    break;
+
+  case 1:
+    if( ch == 2 ) {
+      c.length = 256 - data;
+    }
+    else {
+      c.length = 64 - ( data & 0x3f );
+      c.duty = data >> 6;
+    }
+    break;
+
+  case 2:
+    if( ch == 2 ) {
+      static const int shifts[ 4 ] = { 4, 0, 1, 2 };
+      waveVolumeShift = shifts[ ( data >> 5 ) & 0x3 ];
+    }
+    else {
+      c.envelopeInitial = data >> 4;
+      c.envelopeUp = ( data & 0x08 ) > 0;
+      c.envelopePeriod = data & 0x7;
+      c.dacEnabled = ( data & 0xf8 ) != 0;
+      if( !c.dacEnabled ) {
+        c.enabled = false;
+      }
+    }
+    break;
+
+  case 3:
+    if( ch == 3 ) {
+      noiseShift = data >> 4;
+      noiseWidth7 = ( data & 0x08 ) > 0;
+      noiseDivisor = data & 0x7;
+    }
+    else {
+      c.frequency = ( c.frequency & 0x700 ) | data;
+    }
+    break;
+
+  case 4:
+    if( ch != 3 ) {
+      c.frequency = ( c.frequency & 0xff ) | ( ( data & 0x7 ) << 8 );
+    }
+    c.lengthEnabled = ( data & 0x40 ) > 0;
+    if( data & 0x80 ) {
+      trigger( ch );
+    }
+    break;
+  }
+}
+
+void
+APU::trigger( int ch ) {
+  Channel& c = channels[ ch ];
+
+  c.enabled = c.dacEnabled;
+  if( c.length == 0 ) {
+    c.length = ch == 2 ? 256 : 64;
+  }
+
+  c.timer = period( ch );
+  c.position = 0;
+  c.volume = c.envelopeInitial;
+  c.envelopeTimer = c.envelopePeriod;
+
+  if( ch == 3 ) {
+    lfsr = 0x7fff;
+  }
+
+  if( ch == 0 ) {
+    sweepShadow = c.frequency;
+    sweepTimer = sweepPeriod ? sweepPeriod : 8;
+    sweepEnabled = sweepPeriod > 0 || sweepShift > 0;
+    if( sweepShift > 0 && sweepCalculate() > 2047 ) {
+      c.enabled = false;
+    }
+  }
+}
+
+int
+APU::sweepCalculate() {
+  int delta = sweepShadow >> sweepShift;
+  return sweepNegate ? sweepShadow - delta : sweepShadow + delta;
+}
+
+// Frame sequencer, clocked at 512 Hz
+//  Step   Length  Sweep  Envelope
+//  0      x
+//  2      x       x
+//  4      x
+//  6      x       x
+//  7                     x
+void
+APU::stepSequencer() {
+  int step = sequencerStep;
+  sequencerStep = ( sequencerStep + 1 ) & 7;
+
+  if( !power ) {
+    return;
+  }
+
+  if( ( step & 1 ) == 0 ) {
+    for( auto& c : channels ) {
+      if( c.lengthEnabled && c.length > 0 ) {
+        if( --c.length == 0 ) {
+          c.enabled = false;
+        }
+      }
+    }
+  }
+
+  if( step == 2 || step == 6 ) {
+    if( --sweepTimer <= 0 ) {
+      sweepTimer = sweepPeriod ? sweepPeriod : 8;
+
+      if( sweepEnabled && sweepPeriod > 0 ) {
+        int frequency = sweepCalculate();
+        if( frequency > 2047 ) {
+          channels[ 0 ].enabled = false;
+        }
+        else if( sweepShift > 0 ) {
+          sweepShadow = frequency;
+          channels[ 0 ].frequency = frequency;
+          if( sweepCalculate() > 2047 ) {
+            channels[ 0 ].enabled = false;
+          }
+        }
+      }
+    }
+  }
+
+  if( step == 7 ) {
+    for( int ch : { 0, 1, 3 } ) {
+      Channel& c = channels[ ch ];
+      if( c.envelopePeriod == 0 ) {
+        continue;
+      }
+
+      if( --c.envelopeTimer <= 0 ) {
+        c.envelopeTimer = c.envelopePeriod;
+        if( c.envelopeUp && c.volume < 15 ) {
+          c.volume++;
+        }
+        else if( !c.envelopeUp && c.volume > 0 ) {
+          c.volume--;
+        }
+      }
+    }
+  }
+}
+
+void
+APU::powerOff() {
+  for( auto& c : channels ) {
+    int level = c.level;
+    c = Channel{};
+    c.level = level;  // the blip buffer still has to be told the level dropped
+  }
+
+  sweepPeriod = 0;
+  sweepNegate = false;
+  sweepShift = 0;
+  sweepEnabled = false;
+  waveVolumeShift = 4;
+  noiseShift = 0;
+  noiseWidth7 = false;
+  noiseDivisor = 0;
+  nr50 = 0;
+  nr51 = 0;
+}
+
+void
+APU::Channel::save( StateWriter& state ) const {
+  state.put( enabled );
+  state.put( dacEnabled );
+  state.put( length );
+  state.put( lengthEnabled );
+  state.put( volume );
+  state.put( envelopeInitial );
+  state.put( envelopeUp );
+  state.put( envelopePeriod );
+  state.put( envelopeTimer );
+  state.put( frequency );
+  state.put( duty );
+  state.put( timer );
+  state.put( position );
+  state.put( level );
+}
+
+void
+APU::Channel::load( StateReader& state ) {
+  state.get( enabled );
+  state.get( dacEnabled );
+  state.get( length );
+  state.get( lengthEnabled );
+  state.get( volume );
+  state.get( envelopeInitial );
+  state.get( envelopeUp );
+  state.get( envelopePeriod );
+  state.get( envelopeTimer );
+  state.get( frequency );
+  state.get( duty );
+  state.get( timer );
+  state.get( position );
+  state.get( level );
+}
+
+void
+APU::save( StateWriter& state ) const {
+  state.put( static_cast< u64 >( writeLog.size() ) );
+  for( auto& write : writeLog ) {
+    state.put( write.time );
+    state.put( write.address );
+    state.put( write.data );
+  }
+  state.put( nextWrite );
+  state.put( cursor );
+  state.put( frameStart );
+  state.put( frameEnd );
+  state.put( sequencerNext );
+  state.put( sequencerStep );
+  state.put( power );
+  for( auto& channel : channels ) {
+    channel.save( state );
+  }
+  state.put( sweepPeriod );
+  state.put( sweepNegate );
+  state.put( sweepShift );
+  state.put( sweepTimer );
+  state.put( sweepEnabled );
+  state.put( sweepShadow );
+  state.put( waveVolumeShift );
+  state.put( waveRAM );
+  state.put( noiseShift );
+  state.put( noiseWidth7 );
+  state.put( noiseDivisor );
+  state.put( lfsr );
+  state.put( nr50 );
+  state.put( nr51 );
+}
+
+void
+APU::load( StateReader& state ) {
+  writeLog.resize( state.getCount( sizeof( u32 ) + sizeof( u16 ) + sizeof( u8 ) ) );
+  for( auto& write : writeLog ) {
+    state.get( write.time );
+    state.get( write.address );
+    state.get( write.data );
+  }
+  state.get( nextWrite );
+  state.get( cursor );
+  state.get( frameStart );
+  state.get( frameEnd );
+  state.get( sequencerNext );
+  state.get( sequencerStep );
+  state.get( power );
+  for( auto& channel : channels ) {
+    channel.load( state );
+  }
+  state.get( sweepPeriod );
+  state.get( sweepNegate );
+  state.get( sweepShift );
+  state.get( sweepTimer );
+  state.get( sweepEnabled );
+  state.get( sweepShadow );
+  state.get( waveVolumeShift );
+  state.get( waveRAM );
+  state.get( noiseShift );
+  state.get( noiseWidth7 );
+  state.get( noiseDivisor );
+  state.get( lfsr );
+  state.get( nr50 );
+  state.get( nr51 );
+}
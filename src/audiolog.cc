@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+#include "../include/audiolog.hh"
+#include "../include/mixer.hh"
+
+static const int channels = 2;
+static const int bytesPerSample = 2;
+static const u32 wavHeaderSize = 44;
+
+AudioLog::AudioLog() {
+  auto keys = conf->GetKeys();
+
+  auto hasAudioLog = std::find( keys.begin(), keys.end(), "AudioLog" );
+  if( hasAudioLog == keys.end() ) {
+    return;
+  }
+
+  auto fileName = conf->GetValue( *hasAudioLog );
+
+  auto extension = fileName.substr( fileName.find_last_of( '.' ) + 1 );
+  auto formatName = conf->GetValue( "AudioFormat" );
+  if( formatName.empty() ) {
+    formatName = extension;
+  }
+
+  open( fileName, formatName == "WAV" || formatName == "wav" ? wav : raw );
+}
+
+AudioLog::AudioLog( const std::string& fileName, Format format ) {
+  open( fileName, format );
+}
+
+void
+AudioLog::open( const std::string& fileName, Format format ) {
+  this->fileName = fileName;
+  this->format = format;
+
+  os.open( fileName, std::ios::binary | std::ios::trunc );
+  if( !os.is_open() ) {
+    _log->Write( Log::error, "Unable to open audio log " + fileName );
+    return;
+  }
+
+  if( format == wav ) {
+    writeHeader( 0 );
+  }
+
+  // About half a second of frames
+  queue = std::make_unique< SpscRing< std::vector< float > > >( 32 );
+  enabled = true;
+  worker = std::thread( &AudioLog::run, this );
+}
+
+AudioLog::~AudioLog() {
+  if( !enabled ) {
+    return;
+  }
+
+  done.store( true, std::memory_order_release );
+  worker.join();
+
+  if( format == wav ) {
+    // The sizes in the header are 32 bits; a longer recording keeps what fits
+    os.seekp( 0 );
+    writeHeader( static_cast< u32 >( std::min< u64 >( bytesWritten, 0xffffffffu - wavHeaderSize ) ) );
+  }
+  os.close();
+
+  char buffer[ 1024 ] = { 0 };
+  sprintf( buffer, "Audio log wrote %lu bytes of %lu blocks to %s, %lu waited for the writer",
+           bytesWritten, blocksSubmitted, fileName.c_str(), blocksDelayed );
+  _log->Write( Log::info, buffer );
+}
+
+void
+AudioLog::submit( const std::vector< float >& samples ) {
+  if( !enabled || samples.empty() ) {
+    return;
+  }
+
+  blocksSubmitted++;
+
+  // Audio is never dropped; a gap would be worse than slowing the emulator down
+  auto slot = queue->reserve();
+  if( slot == nullptr ) {
+    blocksDelayed++;
+    do {
+      std::this_thread::yield();
+      slot = queue->reserve();
+    } while( slot == nullptr );
+  }
+
+  // The slot keeps its capacity, so after the first lap this doesn't allocate
+  slot->assign( samples.begin(), samples.end() );
+  queue->commit();
+}
+
+void
+AudioLog::run() {
+  for( ;; ) {
+    auto block = queue->front();
+
+    if( block != nullptr ) {
+      write( *block );
+      queue->release();
+    }
+    else if( done.load( std::memory_order_acquire ) ) {
+      // The producer has stopped; one more look at the queue drains anything left
+      if( queue->empty() ) {
+        break;
+      }
+    }
+    else {
+      std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+    }
+  }
+
+  os.flush();
+}
+
+void
+AudioLog::write( const std::vector< float >& samples ) {
+  pcm.resize( samples.size() * bytesPerSample );
+
+  for( std::size_t i = 0; i < samples.size(); i++ ) {
+    float clamped = std::max( -1.0f, std::min( 1.0f, samples[ i ] ) );
+    auto value = static_cast< i16 >( std::lround( clamped * 32767.0f ) );
+    pcm[ i * 2 ] = static_cast< char >( value & 0xff );
+    pcm[ i * 2 + 1 ] = static_cast< char >( ( value >> 8 ) & 0xff );
+  }
+
+  os.write( pcm.data(), pcm.size() );
+  bytesWritten += pcm.size();
+}
+
+// Canonical 44 byte RIFF/WAVE header for 16-bit PCM
+void
+AudioLog::writeHeader( u32 dataBytes ) {
+  auto put16 = [ this ]( u16 value ) {
+    char bytes[ 2 ] = { static_cast< char >( value & 0xff ), static_cast< char >( value >> 8 ) };
+    os.write( bytes, 2 );
+  };
+  auto put32 = [ & ]( u32 value ) {
+    put16( value & 0xffff );
+    put16( value >> 16 );
+  };
+
+  u32 rate = Mixer::outputRate;
+
+  os.write( "RIFF", 4 );
+  put32( wavHeaderSize - 8 + dataBytes );
+  os.write( "WAVE", 4 );
+
+  os.write( "fmt ", 4 );
+  put32( 16 );
+  put16( 1 );  // PCM
+  put16( channels );
+  put32( rate );
+  put32( rate * channels * bytesPerSample );
+  put16( channels * bytesPerSample );
+  put16( bytesPerSample * 8 );
+
+  os.write( "data", 4 );
+  put32( dataBytes );
+}
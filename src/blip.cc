@@ -0,0 +1,82 @@
+#include <algorithm>
+#include <cmath>
+
+#include "../include/blip.hh"
+
+float BlipBuffer::kernel[ BlipBuffer::phases ][ BlipBuffer::taps ];
+bool BlipBuffer::kernelReady = false;
+
+BlipBuffer::BlipBuffer() {
+  if( !kernelReady ) {
+    // Blackman windowed sinc, cut off a little below the output Nyquist frequency.  Each
+    // phase is the impulse for a step that lands that many T-cycles into a sample.
+    const double pi = 3.14159265358979323846;
+    const double cutoff = 0.45;
+
+    for( int p = 0; p < phases; p++ ) {
+      double sum = 0;
+      for( int k = 0; k < taps; k++ ) {
+        double x = k - taps / 2 + 1 - static_cast< double >( p ) / phases;
+        double sinc = x == 0 ? 1.0 : std::sin( 2 * pi * cutoff * x ) / ( 2 * pi * cutoff * x );
+        double w = ( x + taps / 2 ) / taps;
+        double window = 0.42 - 0.5 * std::cos( 2 * pi * w ) + 0.08 * std::cos( 4 * pi * w );
+        kernel[ p ][ k ] = sinc * window;
+        sum += kernel[ p ][ k ];
+      }
+
+      // A step of height d must integrate to exactly d
+      for( int k = 0; k < taps; k++ ) {
+        kernel[ p ][ k ] /= sum;
+      }
+    }
+
+    kernelReady = true;
+  }
+
+  deltas.resize( 4096 + taps );
+}
+
+void
+BlipBuffer::addDelta( u32 time, int delta ) {
+  u32 clock = time + offset;
+  u32 pos = clock / clocksPerSample;
+  const float* impulse = kernel[ clock % clocksPerSample ];
+
+  if( pos + taps > deltas.size() ) {
+    deltas.resize( pos + taps + 1024 );
+  }
+
+  float* out = deltas.data() + pos;
+  for( int k = 0; k < taps; k++ ) {
+    out[ k ] += delta * impulse[ k ];
+  }
+}
+
+int
+BlipBuffer::endFrame( u32 length, std::vector< float >& out ) {
+  u32 clock = length + offset;
+  int count = clock / clocksPerSample;
+  offset = clock % clocksPerSample;
+
+  if( static_cast< std::size_t >( count ) + taps > deltas.size() ) {
+    deltas.resize( count + taps + 1024 );
+  }
+
+  for( int i = 0; i < count; i++ ) {
+    integrator += deltas[ i ];
+    out.push_back( integrator );
+  }
+
+  // Carry the tails of steps near the end of the frame into the next one
+  std::copy( deltas.begin() + count, deltas.begin() + count + taps, deltas.begin() );
+  std::fill( deltas.begin() + taps, deltas.end(), 0.0f );
+
+  return count;
+}
+
+void
+BlipBuffer::clear() {
+  std::fill( deltas.begin(), deltas.end(), 0.0f );
+  offset = 0;
+  integrator = 0;
+}
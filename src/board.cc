@@ -1,12 +1,104 @@
+#include <chrono>
+#include <fstream>
+#include <sstream>
 
 #include "../include/board.hh"
 
+#include "../include/state.hh"
+
+// Bump a section's version whenever what its component saves changes, so states from
+// before the change are refused rather than misread
+struct StateSection {
+  u32 tag;
+  u32 version;
+};
+
+static const StateSection cpuSection{ stateTag( "CPU " ), 1 };
+static const StateSection ramSection{ stateTag( "RAM " ), 1 };
+static const StateSection timerSection{ stateTag( "TIMR" ), 1 };
+static const StateSection serialSection{ stateTag( "SER " ), 2 };
+static const StateSection ppuSection{ stateTag( "PPU " ), 2 };
+static const StateSection apuSection{ stateTag( "APU " ), 2 };
+
+template < typename Component >
+static void
+saveSection( StateWriter& state, const StateSection& section, Component& component ) {
+  state.beginSection( section.tag, section.version );
+  component.save( state );
+  state.endSection();
+}
+
+static void
+checkSection( StateReader& state, const StateSection& section ) {
+  auto version = state.section( section.tag );
+  if( version != section.version ) {
+    char name[ 5 ] = { 0 };
+    std::memcpy( name, &section.tag, 4 );
+
+    std::stringstream ss;
+    ss << "Saved state " << name << " section is version " << version << ", expected "
+       << section.version;
+    throw std::runtime_error( ss.str() );
+  }
+}
+
+template < typename Component >
+static void
+loadSection( StateReader& state, const StateSection& section, Component& component ) {
+  state.section( section.tag );
+  component.load( state );
+}
+
+static u64
+microsecondsSince( std::chrono::steady_clock::time_point start ) {
+  return std::chrono::duration_cast< std::chrono::microseconds >( std::chrono::steady_clock::now() - start )
+    .count();
+}
+
 Board::Board() {
-  bus.initialize( &cpu, &ram, &timer, &serial );
+  bus.initialize( &cpu, &ram, &timer, &serial, &ppu, &apu );
   cpu.initialize( &bus );
   timer.initialize( &cpu, &ram, &bus );
   ram.setBus( &bus );
-  serial.initialize( &bus );
+  serial.initialize( &cpu, &ram, &bus );
+  ppu.initialize( &cpu, &ram, &bus, &frameDump );
+  apu.initialize( &cpu, &ram, &audioLog );
+
+  if( flightRecorder.isEnabled() ) {
+    cpu.setFlightRecorder( &flightRecorder );
+    bus.setFlightRecorder( &flightRecorder );
+  }
+
+  if( rewind.isEnabled() ) {
+    // Going back would need the peer to go back too
+    if( serial.isLinked() ) {
+      throw std::runtime_error( "Rewind can't be used with a link cable" );
+    }
+    rewind.initialize( this );
+    cpu.setRewind( &rewind );
+  }
+
+  auto gdbAddress = conf->GetValue( "GdbStub" );
+  if( !gdbAddress.empty() ) {
+    gdbStub = std::make_unique< GdbStub >( gdbAddress, conf->GetValue( "GdbWait" ) == "true" );
+    gdbStub->initialize( &cpu, &bus );
+    cpu.setGdbStub( gdbStub.get() );
+  }
+
+  auto loadStateFile = conf->GetValue( "LoadState" );
+  if( !loadStateFile.empty() ) {
+    loadState( loadStateFile );
+  }
+
+  saveStateFile = conf->GetValue( "SaveState" );
+  if( !saveStateFile.empty() ) {
+    saveStateAt = conf->GetNumber( "SaveStateAt", 0 );
+  }
+}
+
+void
+Board::dumpFlightRecorder( const std::string& reason, const std::string& suffix ) {
+  flightRecorder.dump( reason, cpu, bus, suffix );
 }
 
 u8
@@ -14,10 +106,131 @@ Board::read8( u16 address ) {
   return ram.read8(address);
 }
 
+void
+Board::write8( u16 address, u8 data ) {
+  bus.write( address, data );
+}
+
+void
+Board::loadCartridge( std::vector< char > image ) {
+  ram.loadImage( std::move( image ) );
+}
+
+void
+Board::setAudioLog( AudioLog* audioLog ) {
+  apu.setAudioLog( audioLog );
+}
+
+void
+Board::connectLink( LinkPort* link, u32 window ) {
+  if( rewind.isEnabled() ) {
+    throw std::runtime_error( "Rewind can't be used with a link cable" );
+  }
+  serial.setLink( link, window );
+}
+
 void
 Board::_clock() {
   timer._clock();
-  cpu._clock();  // keep the cpu as the last call
+  ppu._clock();
+  apu._clock( cpu.ticks );
+  serial._clock( cpu.ticks );
+
+  try {
+    cpu._clock();  // keep the cpu as the last call
+  }
+  catch( Rewind::Request& request ) {
+    rewind.reverse( request.kind );
+    return;
+  }
+
+  if( cpu.ticks >= rewind.nextSnapshot() ) {
+    rewind.snapshot();
+  }
+
+  if( cpu.ticks >= saveStateAt && cpu.atInstructionBoundary() && !replaying ) {
+    saveStateAt = UINT64_MAX;
+    saveState( saveStateFile );
+  }
+}
+
+void
+Board::save( std::vector< u8 >& buffer ) {
+  StateWriter state( buffer, ram.cartId() );
+
+  saveSection( state, cpuSection, cpu );
+  saveSection( state, ramSection, ram );
+  saveSection( state, timerSection, timer );
+  saveSection( state, serialSection, serial );
+  saveSection( state, ppuSection, ppu );
+  saveSection( state, apuSection, apu );
+}
+
+void
+Board::load( const std::vector< u8 >& buffer ) {
+  StateReader state( buffer );
+
+  if( state.cart() != ram.cartId() ) {
+    throw std::runtime_error( "Saved state is for another cartridge" );
+  }
+
+  // Refuse the state before any component has been changed
+  for( auto section : { cpuSection, ramSection, timerSection, serialSection, ppuSection, apuSection } ) {
+    checkSection( state, section );
+  }
+
+  loadSection( state, cpuSection, cpu );
+  loadSection( state, ramSection, ram );
+  loadSection( state, timerSection, timer );
+  loadSection( state, serialSection, serial );
+  loadSection( state, ppuSection, ppu );
+  loadSection( state, apuSection, apu );
+}
+
+void
+Board::saveState( const std::string& fileName ) {
+  std::vector< u8 > buffer;
+
+  auto start = std::chrono::steady_clock::now();
+  save( buffer );
+  auto elapsed = microsecondsSince( start );
+
+  std::ofstream os( fileName, std::ios::binary | std::ios::trunc );
+  os.write( reinterpret_cast< const char* >( buffer.data() ), buffer.size() );
+  if( !os ) {
+    throw std::runtime_error( "Unable to write saved state " + fileName );
+  }
+
+  std::stringstream ss;
+  ss << "Saved state " << fileName << " on tick " << cpu.ticks << ", " << buffer.size() << " bytes in "
+     << elapsed << " us";
+  _log->Write( Log::info, ss.str() );
+}
+
+void
+Board::loadState( const std::string& fileName ) {
+  std::ifstream is( fileName, std::ios::binary );
+  std::vector< u8 > buffer{ std::istreambuf_iterator< char >( is ), std::istreambuf_iterator< char >() };
+  if( !is.is_open() || buffer.empty() ) {
+    throw std::runtime_error( "Unable to read saved state " + fileName );
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  load( buffer );
+  auto elapsed = microsecondsSince( start );
+
+  std::stringstream ss;
+  ss << "Loaded state " << fileName << " at tick " << cpu.ticks << ", " << buffer.size() << " bytes in "
+     << elapsed << " us";
+  _log->Write( Log::info, ss.str() );
+}
+
+void
+Board::setReplaying( bool replaying ) {
+  this->replaying = replaying;
+  serial.setMuted( replaying );
+  ppu.setMuted( replaying );
+  apu.setMuted( replaying );
 }
 
 CPU&
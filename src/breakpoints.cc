@@ -0,0 +1,528 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include "../include/breakpoints.hh"
+
+#include "../include/bus.hh"
+#include "../include/cpu.hh"
+
+static u8 CPU::Registers::*registers8[ 8 ] {
+  &CPU::Registers::A,
+  &CPU::Registers::F,
+  &CPU::Registers::B,
+  &CPU::Registers::C,
+  &CPU::Registers::D,
+  &CPU::Registers::E,
+  &CPU::Registers::H,
+  &CPU::Registers::L
+};
+
+static const char* registerNames8[ 8 ] = { "A", "F", "B", "C", "D", "E", "H", "L" };
+
+// PC is not here: during a fetch regs.PC is already past the instruction
+static u16 CPU::Registers::*registers16[ 5 ] {
+  &CPU::Registers::AF,
+  &CPU::Registers::BC,
+  &CPU::Registers::DE,
+  &CPU::Registers::HL,
+  &CPU::Registers::SP
+};
+
+static const char* registerNames16[ 6 ] = { "AF", "BC", "DE", "HL", "SP", "PC" };
+
+Condition::Condition( const std::string& text )
+  : source( text ) {
+  parseOr();
+
+  skipSpace();
+  if( at != source.size() ) {
+    fail( "unexpected " + source.substr( at ) );
+  }
+  if( maxSeen > maxDepth ) {
+    fail( "too deeply nested" );
+  }
+}
+
+bool
+Condition::evaluate( const CPU& cpu, Bus& bus ) const {
+  int stack[ maxDepth ];
+  int top = -1;
+
+  for( std::size_t pc = 0; pc < code.size(); pc++ ) {
+    const Instruction& instruction = code[ pc ];
+
+    switch( instruction.op ) {
+    case push:
+      stack[ ++top ] = instruction.operand;
+      break;
+
+    case reg8:
+      stack[ ++top ] = cpu.regs.*registers8[ instruction.operand ];
+      break;
+
+    case reg16:
+      stack[ ++top ] = instruction.operand < 5 ? cpu.regs.*registers16[ instruction.operand ]
+                                               : cpu.addrCurrentInstr;
+      break;
+
+    case read:
+      stack[ top ] = bus.peek( stack[ top ] & 0xffff );
+      break;
+
+    case logicalNot:
+      stack[ top ] = !stack[ top ];
+      break;
+
+    case complement:
+      stack[ top ] = ~stack[ top ];
+      break;
+
+    case negate:
+      stack[ top ] = -stack[ top ];
+      break;
+
+    case toBool:
+      stack[ top ] = stack[ top ] != 0;
+      break;
+
+    case jumpIfFalse:
+    case jumpIfTrue:
+      if( ( stack[ top ] != 0 ) == ( instruction.op == jumpIfTrue ) ) {
+        pc = instruction.operand - 1;
+      }
+      else {
+        top--;
+      }
+      break;
+
+    default: {
+      int right = stack[ top-- ];
+      int& left = stack[ top ];
+
+      switch( instruction.op ) {
+      case add:          left = left + right; break;
+      case subtract:     left = left - right; break;
+      case bitAnd:       left = left & right; break;
+      case bitXor:       left = left ^ right; break;
+      case bitOr:        left = left | right; break;
+      case equal:        left = left == right; break;
+      case notEqual:     left = left != right; break;
+      case less:         left = left < right; break;
+      case lessEqual:    left = left <= right; break;
+      case greater:      left = left > right; break;
+      case greaterEqual: left = left >= right; break;
+      default:
+        break;
+      }
+      break;
+    }
+    }
+  }
+
+  return stack[ 0 ] != 0;
+}
+
+void
+Condition::emit( Op op, u16 operand ) {
+  code.push_back( { op, operand } );
+
+  switch( op ) {
+  case push:
+  case reg8:
+  case reg16:
+    depth++;
+    break;
+
+  case read:
+  case logicalNot:
+  case complement:
+  case negate:
+  case toBool:
+    break;
+
+  default:
+    // Binary operators, and jumps when they fall through
+    depth--;
+    break;
+  }
+
+  maxSeen = std::max( maxSeen, depth );
+}
+
+// expr || expr ...: each side is turned into 0 or 1, and a true left side skips the rest
+void
+Condition::parseOr() {
+  parseAnd();
+
+  std::vector< std::size_t > jumps;
+  while( accept( "||" ) ) {
+    emit( toBool );
+    jumps.push_back( code.size() );
+    emit( jumpIfTrue );
+    parseAnd();
+  }
+
+  if( !jumps.empty() ) {
+    emit( toBool );
+    for( auto jump : jumps ) {
+      code[ jump ].operand = code.size();
+    }
+  }
+}
+
+void
+Condition::parseAnd() {
+  parseBitOr();
+
+  std::vector< std::size_t > jumps;
+  while( accept( "&&" ) ) {
+    emit( toBool );
+    jumps.push_back( code.size() );
+    emit( jumpIfFalse );
+    parseBitOr();
+  }
+
+  if( !jumps.empty() ) {
+    emit( toBool );
+    for( auto jump : jumps ) {
+      code[ jump ].operand = code.size();
+    }
+  }
+}
+
+void
+Condition::parseBitOr() {
+  parseBitXor();
+
+  for( ;; ) {
+    skipSpace();
+    if( source.compare( at, 2, "||" ) == 0 || !accept( "|" ) ) {
+      return;
+    }
+    parseBitXor();
+    emit( bitOr );
+  }
+}
+
+void
+Condition::parseBitXor() {
+  parseBitAnd();
+
+  while( accept( "^" ) ) {
+    parseBitAnd();
+    emit( bitXor );
+  }
+}
+
+void
+Condition::parseBitAnd() {
+  parseCompare();
+
+  for( ;; ) {
+    skipSpace();
+    if( source.compare( at, 2, "&&" ) == 0 || !accept( "&" ) ) {
+      return;
+    }
+    parseCompare();
+    emit( bitAnd );
+  }
+}
+
+void
+Condition::parseCompare() {
+  // Two character operators first, so < doesn't take the start of <=
+  static const std::pair< const char*, Op > operators[] = {
+    { "==", equal },
+    { "!=", notEqual },
+    { "<=", lessEqual },
+    { ">=", greaterEqual },
+    { "<", less },
+    { ">", greater },
+  };
+
+  parseSum();
+
+  for( ;; ) {
+    auto found = std::find_if( std::begin( operators ), std::end( operators ), [ this ]( auto& o ) {
+      return accept( o.first );
+    } );
+    if( found == std::end( operators ) ) {
+      return;
+    }
+
+    parseSum();
+    emit( found->second );
+  }
+}
+
+void
+Condition::parseSum() {
+  parseUnary();
+
+  for( ;; ) {
+    if( accept( "+" ) ) {
+      parseUnary();
+      emit( add );
+    }
+    else if( accept( "-" ) ) {
+      parseUnary();
+      emit( subtract );
+    }
+    else {
+      return;
+    }
+  }
+}
+
+void
+Condition::parseUnary() {
+  if( accept( "!" ) ) {
+    parseUnary();
+    emit( logicalNot );
+  }
+  else if( accept( "~" ) ) {
+    parseUnary();
+    emit( complement );
+  }
+  else if( accept( "-" ) ) {
+    parseUnary();
+    emit( negate );
+  }
+  else {
+    parsePrimary();
+  }
+}
+
+void
+Condition::parsePrimary() {
+  skipSpace();
+
+  if( accept( "(" ) ) {
+    parseOr();
+    if( !accept( ")" ) ) {
+      fail( "missing )" );
+    }
+    return;
+  }
+
+  if( accept( "[" ) ) {
+    parseOr();
+    if( !accept( "]" ) ) {
+      fail( "missing ]" );
+    }
+    emit( read );
+    return;
+  }
+
+  if( at < source.size() && ( std::isdigit( source[ at ] ) || source[ at ] == '$' ) ) {
+    int base = 10;
+    if( source[ at ] == '$' ) {
+      base = 16;
+      at++;
+    }
+    else if( source.compare( at, 2, "0x" ) == 0 || source.compare( at, 2, "0X" ) == 0 ) {
+      base = 16;
+      at += 2;
+    }
+
+    const char* start = source.c_str() + at;
+    char* end;
+    unsigned long value = std::strtoul( start, &end, base );
+    if( end == start || value > 0xffff ) {
+      fail( "bad number at " + source.substr( at ) );
+    }
+    at += end - start;
+
+    emit( push, value );
+    return;
+  }
+
+  std::string name;
+  while( at < source.size() && std::isalpha( source[ at ] ) ) {
+    name += std::toupper( source[ at++ ] );
+  }
+
+  for( u16 i = 0; i < 6; i++ ) {
+    if( name == registerNames16[ i ] ) {
+      emit( reg16, i );
+      return;
+    }
+  }
+  for( u16 i = 0; i < 8; i++ ) {
+    if( name == registerNames8[ i ] ) {
+      emit( reg8, i );
+      return;
+    }
+  }
+
+  fail( name.empty() ? "expected a value at " + source.substr( at ) : "unknown register " + name );
+}
+
+void
+Condition::skipSpace() {
+  while( at < source.size() && std::isspace( source[ at ] ) ) {
+    at++;
+  }
+}
+
+bool
+Condition::accept( const char* token ) {
+  skipSpace();
+
+  auto length = std::strlen( token );
+  if( source.compare( at, length, token ) != 0 ) {
+    return false;
+  }
+
+  at += length;
+  return true;
+}
+
+void
+Condition::fail( const std::string& message ) {
+  throw std::runtime_error( "Breakpoint condition " + source + ": " + message );
+}
+
+Breakpoints::Breakpoints() {
+  std::stringstream ss{ conf->GetValue( "Breakpoints" ) };
+  std::string breakpoint;
+
+  while( std::getline( ss, breakpoint, ';' ) ) {
+    if( breakpoint.find_first_not_of( " \t" ) != std::string::npos ) {
+      add( breakpoint );
+    }
+  }
+}
+
+void
+Breakpoints::initialize( Bus* bus ) {
+  this->bus = bus;
+}
+
+void
+Breakpoints::add( const std::string& text ) {
+  std::stringstream ss{ text };
+  std::string location;
+  std::string keyword;
+  ss >> location >> keyword;
+
+  Entry entry{ 0, -1, {} };
+
+  try {
+    auto colon = location.find( ':' );
+    if( colon != std::string::npos ) {
+      entry.bank = std::stoi( location.substr( 0, colon ), nullptr, 16 );
+    }
+    auto address = std::stoul( location.substr( colon == std::string::npos ? 0 : colon + 1 ), nullptr, 16 );
+    if( address > 0xffff ) {
+      throw std::out_of_range( location );
+    }
+    entry.address = address;
+  }
+  catch( std::logic_error& ) {
+    throw std::runtime_error( "Can't read the breakpoint address " + location );
+  }
+
+  if( entry.bank >= 0 && ( entry.address < 0x4000 || entry.address >= 0x8000 ) ) {
+    throw std::runtime_error( "Breakpoint " + location + ": only 4000 - 7fff is banked" );
+  }
+
+  if( !keyword.empty() ) {
+    if( keyword != "if" ) {
+      throw std::runtime_error( "Expected if after the breakpoint address, not " + keyword );
+    }
+
+    std::string condition;
+    std::getline( ss, condition );
+    condition.erase( 0, condition.find_first_not_of( " \t" ) );
+    condition.erase( condition.find_last_not_of( " \t" ) + 1 );
+    entry.condition = Condition( condition );
+  }
+
+  // Setting the same place again replaces its condition
+  auto same = std::find_if( entries.begin(), entries.end(), [ & ]( const Entry& e ) {
+    return e.address == entry.address && e.bank == entry.bank;
+  } );
+  if( same != entries.end() ) {
+    *same = std::move( entry );
+  }
+  else {
+    entries.push_back( std::move( entry ) );
+  }
+
+  rebuild();
+}
+
+bool
+Breakpoints::remove( u16 address ) {
+  auto end = std::remove_if( entries.begin(), entries.end(), [ & ]( const Entry& e ) {
+    return e.address == address;
+  } );
+  bool removed = end != entries.end();
+
+  entries.erase( end, entries.end() );
+  rebuild();
+
+  return removed;
+}
+
+void
+Breakpoints::clear() {
+  entries.clear();
+  rebuild();
+}
+
+std::string
+Breakpoints::list() const {
+  std::string text;
+
+  for( auto& entry : entries ) {
+    char buffer[ 32 ];
+    if( entry.bank >= 0 ) {
+      sprintf( buffer, "%x:%04x", entry.bank, entry.address );
+    }
+    else {
+      sprintf( buffer, "%04x", entry.address );
+    }
+
+    text += buffer;
+    if( !entry.condition.isAlways() ) {
+      text += " if " + entry.condition.text();
+    }
+    text += '\n';
+  }
+
+  return text;
+}
+
+void
+Breakpoints::rebuild() {
+  std::fill( std::begin( pages ), std::end( pages ), 0 );
+  std::fill( std::begin( bits ), std::end( bits ), 0 );
+
+  for( auto& entry : entries ) {
+    pages[ entry.address >> 8 ] = 1;
+    bits[ entry.address >> 6 ] |= 1ull << ( entry.address & 63 );
+  }
+}
+
+bool
+Breakpoints::hitSlow( u16 pc, const CPU& cpu ) {
+  for( auto& entry : entries ) {
+    if( entry.address != pc ) {
+      continue;
+    }
+    if( entry.bank >= 0 && bus->romBank() != entry.bank ) {
+      continue;
+    }
+    if( entry.condition.isAlways() || entry.condition.evaluate( cpu, *bus ) ) {
+      return true;
+    }
+  }
+
+  return false;
+}
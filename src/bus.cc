@@ -1,6 +1,9 @@
 
 #include "../include/bus.hh"
+#include "../include/apu.hh"
 #include "../include/cpu.hh"
+#include "../include/ppu.hh"
+#include "../include/flightrecorder.hh"
 #include "../include/ram.hh"
 #include "../include/serial.hh"
 #include "../include/timer.hh"
@@ -50,19 +53,24 @@
 // $FF4B	  WX	    Window X position plus 7	R/W	
 
 void
-Bus::initialize( CPU* cpu, RAM* ram, Timer* timer, Serial* serial ) {
+Bus::initialize( CPU* cpu, RAM* ram, Timer* timer, Serial* serial, PPU* ppu, APU* apu ) {
   this->cpu = cpu;
   this->ram = ram;
   this->timer = timer;
   this->serial = serial;
+  this->ppu = ppu;
+  this->apu = apu;
 }
 
 void
+Bus::setFlightRecorder( FlightRecorder* recorder ) {
+  this->recorder = recorder;
+}
+
+bool
 Bus::doIO( u16 address, u8 data ) {
   if( address < 0xff00 || 0xff7f < address ) {
-    char buffer[ 1024 ] = { 0 };
-    sprintf( buffer, "Attempt to do IO at address 0x%04x which is outside of IO map; doing nothing.", address );
-    _log->Write( Log::warn, buffer );
+    GBE_LOG( warn, "Attempt to do IO at address 0x%04x which is outside of IO map; doing nothing.", address );
   }
   else {
     switch( address ) {
@@ -77,6 +85,11 @@ Bus::doIO( u16 address, u8 data ) {
       ram->write( address, data );
       break;
 
+    case TIMA:
+    case TMA:
+      ram->write( address, data );
+      break;
+
     case IF:
       ram->write( address, data );
       break;
@@ -90,67 +103,109 @@ Bus::doIO( u16 address, u8 data ) {
       serial->write();
       break;
 
+    case LCDC:
+      ram->write( address, data );
+      ppu->write( address, data );
+      ppu->setLCDC( data );
+      break;
+
+    case STAT:
+      // The mode and coincidence bits are read only
+      ram->write( address, ( data & 0x78 ) | ( ram->read8( address ) & 0x07 ) | 0x80 );
+      break;
+
     case SCX:
     case SCY:
-    case LY:
-    case LCDC: {
+    case WY:
+    case WX:
+    case BGP:
+    case OBP0:
+    case OBP1:
+      ram->write( address, data );
+      ppu->write( address, data );
+      break;
+
+    case LYC:
+      ram->write( address, data );
+      break;
+
+    case LY: {
       // TODO: Fix me, should this work?  For debugging cpu_instrs.gb
-      char buffer[1024] = {0};
-      sprintf( buffer, "Write to LCD  port 0x%04x with data 0x%02x from address 0x%04x"
+      GBE_LOG( warn, "Write to LCD  port 0x%04x with data 0x%02x from address 0x%04x"
                " not properly implemented yet",
                address, data, cpu->addrCurrentInstr );
-      _log->Write(Log::warn, buffer);
       ram->write( address, data );
       }
       break;
 
-    case BGP:
-    case OBP0:
-    case OBP1: {
-      char buffer[ 1024 ] = { 0 };
-      sprintf( buffer, "Palette port 0x%04x not implemented yet", address );
-      _log->Write( Log::warn, buffer );
-      ram->write( address, data );
-    }
-      break;
-
     case 0xff4f:
     case 0xff68:
     case 0xff69: {
       // Not sure why the cpu_instr.gb test rom is writing here.  This port has something
       // to do with Color Game Boy BG palettes index.
-      char buffer[ 1024 ] = { 0 };
-      sprintf( buffer, "Write to CGB port 0x%04x with data 0x%02x from address 0x%04x. "
+      GBE_LOG( warn, "Write to CGB port 0x%04x with data 0x%02x from address 0x%04x. "
                "Why?", address, data, cpu->addrCurrentInstr );
-      _log->Write( Log::warn, buffer );
       ram->write( address, data );
       }
       break;
 
     default: {
       if( IOAddress::SOUND_START <= address && address <= IOAddress::SOUND_END ) {
-        char buffer[ 1024 ] = { 0 };
-        sprintf( buffer, "Sound IO port 0x%04x not implemented yet, attempt to"
-                 " write 0x%02x, from address 0x%04x",
-                 address, data, cpu->addrCurrentInstr );
-        _log->Write( Log::warn, buffer );
+        apu->write( address, data );
+        ram->write( address, data );
       }
       else {
-        char buffer[ 1024 ] = { 0 };
-        sprintf( buffer, "Bus::doIO to address 0x%04x not implemented from address 0x%04x",
-                 address, cpu->addrCurrentInstr );
-        throw std::runtime_error( buffer );
+        return false;
       }
     }
     }
   }
+
+  return true;
 }
 
 u8
 Bus::read( u16 address ) {
+  if( IOAddress::SOUND_START <= address && address <= IOAddress::SOUND_END ) {
+    return apu->read( address );
+  }
   return ram->read8( address );
 }
 
+u8
+Bus::peek( u16 address ) {
+  if( IOAddress::SOUND_START <= address && address <= IOAddress::SOUND_END ) {
+    return apu->read( address );
+  }
+  return ram->peek( address );
+}
+
+bool
+Bus::poke( u16 address, u8 data ) {
+  if( address <= 0x7fff ) {
+    return false;
+  }
+
+  if( 0xff00 <= address && address <= 0xff7f ) {
+    // Only the registers doIO implements
+    return doIO( address, data );
+  }
+  else if( ( 0x8000 <= address && address <= 0x9fff ) || ( 0xfe00 <= address && address <= 0xfe9f ) ) {
+    // The renderer keeps its own copy of VRAM and OAM
+    ram->poke( address, data );
+    ppu->write( address, data );
+  }
+  else {
+    ram->poke( address, data );
+  }
+  return true;
+}
+
+u8
+Bus::romBank() {
+  return ram->romBank();
+}
+
 std::string
 Bus::hexDump( u16 start, u16 count ) {
   return ram->hexDump( start, count );
@@ -158,6 +213,9 @@ Bus::hexDump( u16 start, u16 count ) {
 
 void
 Bus::write(u16 address, u8 data ){
+  if( recorder ) {
+    recorder->write( cpu->ticks, address, data );
+  }
 
   if( address == Bus::IOAddress::DIV ) {
     // Any write to the DIV io port set the port to zero
@@ -165,18 +223,31 @@ Bus::write(u16 address, u8 data ){
   }
 
   if( 0xff00 <= address && address <= 0xff7f ) {
-    doIO( address, data );
+    if( !doIO( address, data ) ) {
+      char buffer[ 1024 ] = { 0 };
+      sprintf( buffer, "Bus::doIO to address 0x%04x not implemented from address 0x%04x",
+               address, cpu->addrCurrentInstr );
+      throw std::runtime_error( buffer );
+    }
+  }
+  else if( 0x8000 <= address && address <= 0x9fff ) {
+    // VRAM and OAM writes are also seen by the PPU's renderer, unless the PPU has them locked
+    ram->write( address, data );
+    if( !ram->isVRAMLocked() ) {
+      ppu->write( address, data );
+    }
+  }
+  else if( 0xfe00 <= address && address <= 0xfe9f ) {
+    ram->write( address, data );
+    if( !ram->isOAMLocked() ) {
+      ppu->write( address, data );
+    }
   }
   else {
     ram->write( address, data );
   }
 }
 
-void
-Bus::dbgWrite( u16 address, u8 data ) {
-  ram->dbgWrite( address, data );
-}
-
 Timer*
 Bus::getTimer() {
   return timer;
@@ -1,6 +1,9 @@
 
+#include <cerrno>
+#include <cstdlib>
 #include <fstream>
 #include <regex>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -54,6 +57,28 @@ Config::GetValue( std::string key ) {
 
 }
 
+std::uint64_t
+Config::GetNumber( const std::string& key, std::uint64_t fallback, int base ) {
+  auto value = GetValue( key );
+  if( value.empty() ) {
+    return fallback;
+  }
+
+  char* end;
+  errno = 0;
+  auto number = std::strtoull( value.c_str(), &end, base );
+  if( value[ 0 ] == '-' || end == value.c_str() || *end != '\0' || errno == ERANGE ) {
+    throw std::runtime_error( "Bad value for " + key + ": " + value );
+  }
+
+  return number;
+}
+
+void
+Config::RemoveKey( const std::string& key ) {
+  _config.erase( key );
+}
+
 std::vector<std::string>
 Config::split(const std::string &input,
               const std::string &delim) {
@@ -1,10 +1,11 @@
 
 #include <algorithm>
+#include <charconv>
 #include <cstdio>
+#include <cstring>
 #include <iomanip>
 #include <ios>
 #include <iostream>
-#include <regex>
 #include <sstream>
 #include <stdexcept>
 #include <string>
@@ -14,6 +15,10 @@
 
 #include "../include/bus.hh"
 #include "../include/common.hh"
+#include "../include/flightrecorder.hh"
+#include "../include/gdbstub.hh"
+#include "../include/rewind.hh"
+#include "../include/state.hh"
 
 CPU::CPU() {
   auto keys = conf->GetKeys();
@@ -25,16 +30,35 @@ CPU::CPU() {
 
   auto hasTrace = std::find( keys.begin(), keys.end(), "TraceLog");
   if( hasTrace != keys.end() ) {
-    trace.open( conf->GetValue( *hasTrace ) );
     preExec.push_back( &CPU::Trace );
-    tracer = &CPU::debugSummary;
+    tracer = &CPU::formatSummary;
 
+    bool gbdoc = false;
     auto hasTracer = std::find( keys.begin(), keys.end(), "Tracer" );
     if( hasTracer != keys.end() ) {
       if( conf->GetValue( *hasTracer ) == "GBDoc" ) {
-        tracer = &CPU::debugGameboyDoctor;
+        tracer = &CPU::formatGameboyDoctor;
+        gbdoc = true;
       }
     }
+
+    auto format = conf->GetValue( "TraceFormat" );
+    if( format == "binary" || format == "delta" ) {
+      traceWriter = std::make_unique< TraceWriter >( conf->GetValue( *hasTrace ),
+                                                     format == "delta" ? TraceHeader::delta : TraceHeader::fixed,
+                                                     gbdoc ? TraceHeader::gbdoc : 0, traceOpcodes() );
+    }
+    else {
+      trace.open( conf->GetValue( *hasTrace ) );
+    }
+  }
+
+  auto doctorLog = conf->GetValue( "DoctorLog" );
+  if( !doctorLog.empty() ) {
+    doctor = std::make_unique< GBDocCompare >( doctorLog, [ this ]( const TraceRecord& record ) {
+      return debugGameboyDoctor( record );
+    } );
+    preExec.push_back( &CPU::Doctor );
   }
 
   // TODO: This is in place of running the built-in ROM
@@ -49,67 +73,289 @@ CPU::CPU() {
   regs.SP = 0xfffe;
   regs.PC = 0x100;
 
+  parseDescTemplates();
 }
 
 void
 CPU::initialize( Bus *bus ) {
   this->bus = bus;
+  traceFilter.initialize( bus );
+  breakpoints.initialize( bus );
+}
+
+void
+CPU::setFlightRecorder( FlightRecorder* recorder ) {
+  this->recorder = recorder;
+}
+
+void
+CPU::setGdbStub( GdbStub* gdb ) {
+  this->gdb = gdb;
+}
+
+void
+CPU::setRewind( Rewind* rewind ) {
+  this->rewind = rewind;
+}
+
+void
+CPU::save( StateWriter& state ) const {
+  bool prefixed = decodeHandle == &CPU::prefixDecode;
+
+  state.put( regs );
+  state.put( addrCurrentInstr );
+  state.put( ticks );
+  state.put( waitUntilTicks );
+  state.put( interruptsEnabled );
+  state.put( processStatInterrupt );
+  state.put( processingInterrupt );
+  state.put( prefixed );
+}
+
+void
+CPU::load( StateReader& state ) {
+  bool prefixed;
+
+  state.get( regs );
+  state.get( addrCurrentInstr );
+  state.get( ticks );
+  state.get( waitUntilTicks );
+  state.get( interruptsEnabled );
+  state.get( processStatInterrupt );
+  state.get( processingInterrupt );
+  state.get( prefixed );
+
+  decodeHandle = prefixed ? &CPU::prefixDecode : &CPU::decode;
+}
+
+void
+CPU::beginReplay( std::vector< u64 >* log, bool everyFetch ) {
+  replaying = true;
+  replayLog = log;
+  savedPreExec.swap( preExec );
+  preExec.clear();
+  if( everyFetch ) {
+    preExec.push_back( &CPU::RecordFetch );
+  }
+  savedGdb = gdb;
+  gdb = nullptr;
+}
+
+void
+CPU::endReplay() {
+  preExec.swap( savedPreExec );
+  gdb = savedGdb;
+  replayLog = nullptr;
+  replaying = false;
+}
+
+void
+CPU::stopAtNextInstruction() {
+  auto i = std::find( preExec.begin(), preExec.end(), &CPU::Step );
+
+  if( i == preExec.end() ) {
+    preExec.push_back( &CPU::Step );
+  }
 }
 
 std::string
-CPU::debugSummary( const InstDetails &instr, u8 parm1, u8 parm2 ) {
-  u16 data16 = ( parm2 << 8 ) | parm1;
-  char formattedSignedData8[ 32 ];
-  char formattedData8[ 32 ];
-  char formattedData16[ 32 ];
-  auto signedData = static_cast< std::int8_t >( parm1 );
-  bool negativeData = signedData < 0;
+CPU::debugSummary( const InstDetails& instr, u8 parm1, u8 parm2 ) {
+  return debugSummary( traceRecord( instr, parm1, parm2 ) );
+}
+
+TraceRecord
+CPU::traceRecord( const InstDetails& instr, u8 parm1, u8 parm2 ) {
+  TraceRecord record;
+
+  record.tick = ticks;
+  record.pc = addrCurrentInstr;
+  record.nextPC = regs.PC;
+  record.opcode = instr.binary;
+  record.AF = regs.AF;
+  record.BC = regs.BC;
+  record.DE = regs.DE;
+  record.HL = regs.HL;
+  record.SP = regs.SP;
+  record.params[ 0 ] = parm1;
+  record.params[ 1 ] = parm2;
+  for( int i = 0; i < 4; i++ ) {
+    record.pcmem[ i ] = bus->read( addrCurrentInstr + i );
+  }
+  record.bank = bus->romBank();
+  record.flags = 0;
+
+  return record;
+}
 
-  if( negativeData ) {
-    signedData = -signedData;
+TraceOpcodes
+CPU::traceOpcodes() {
+  TraceOpcodes opcodes;
+
+  for( int i = 0; i < 512; i++ ) {
+    opcodes.bytes[ i ] = instrs[ i ].bytes;
+    opcodes.cycles[ i ] = instrs[ i ].cycles1;
   }
 
-  sprintf( formattedData8, "%02x", parm1 );
-  sprintf( formattedSignedData8, "%s%x", negativeData ? "-" : "", signedData );
-  sprintf(formattedData16, "%04x", data16);
+  return opcodes;
+}
 
-  std::string outline{ instr.desc };
+// Writes value as lower case hex, zero padded to at least digits
+static inline char*
+putHex( char* p, unsigned value, int digits ) {
+  static const char hexDigits[] = "0123456789abcdef";
 
-  outline = std::regex_replace( outline, std::regex( "d8" ), formattedData8 );
-  outline = std::regex_replace( outline, std::regex( "d16" ), formattedData16 );
-  outline = std::regex_replace( outline, std::regex( "a8" ), formattedData8 );
-  outline = std::regex_replace( outline, std::regex( "a16" ), formattedData16 );
-  outline = std::regex_replace( outline, std::regex( "r8" ), formattedSignedData8);
+  while( digits < 8 && ( value >> ( digits * 4 ) ) != 0 ) {
+    digits++;
+  }
+  for( int shift = ( digits - 1 ) * 4; shift >= 0; shift -= 4 ) {
+    *p++ = hexDigits[ ( value >> shift ) & 0xf ];
+  }
 
-  char buffer[ 1024 ] = { 0 };
+  return p;
+}
 
-  auto flags = regs.F;
+static inline char*
+putText( char* p, const std::string& text ) {
+  std::memcpy( p, text.data(), text.size() );
+  return p + text.size();
+}
 
-  // display the regisgers
-  int offset = sprintf( buffer, "AF:%04x BC:%04x DE:%04x HL:%04x PC:%04x SP:%04x %s%s%s%s  %lu ticks\n",
-           regs.AF, regs.BC, regs.DE, regs.HL, regs.PC, regs.SP,
-           ( ( flags & Zmask ) > 0 ? "Z" : "z" ),
-           ( ( flags & Nmask ) > 0 ? "N" : "n" ),
-           ( ( flags & Hmask ) > 0 ? "H" : "h" ),
-           ( ( flags & Cmask ) > 0 ? "C" : "c" ),
-           ticks
-           );
+static inline char*
+putText( char* p, const char* text ) {
+  while( *text ) {
+    *p++ = *text++;
+  }
+  return p;
+}
 
-  offset += sprintf( buffer + offset, "0x%04x:  %02x", addrCurrentInstr, instr.binary );
+void
+CPU::parseDescTemplates() {
+  static const std::pair< const char*, DescPiece::Slot > operands[] = {
+    { "d16", DescPiece::d16 },
+    { "d8", DescPiece::d8 },
+    { "a16", DescPiece::a16 },
+    { "a8", DescPiece::a8 },
+    { "r8", DescPiece::r8 },
+  };
+
+  for( int i = 0; i < 512; i++ ) {
+    const std::string& desc = instrs[ i ].desc;
+    auto& pieces = descTemplates[ i ];
+    std::string literal;
+
+    for( std::size_t at = 0; at < desc.size(); ) {
+      auto operand = std::find_if( std::begin( operands ), std::end( operands ), [ & ]( auto& o ) {
+        return desc.compare( at, std::strlen( o.first ), o.first ) == 0;
+      } );
+
+      if( operand == std::end( operands ) ) {
+        literal += desc[ at++ ];
+        continue;
+      }
+
+      if( !literal.empty() ) {
+        pieces.push_back( { DescPiece::literal, literal } );
+        literal.clear();
+      }
+      pieces.push_back( { operand->second, "" } );
+      at += std::strlen( operand->first );
+    }
+
+    if( !literal.empty() ) {
+      pieces.push_back( { DescPiece::literal, literal } );
+    }
+  }
+}
+
+std::string
+CPU::debugSummary( const TraceRecord& record ) {
+  char line[ traceLineSize ];
+  return std::string( line, formatSummary( record, line ) );
+}
+
+char*
+CPU::formatSummary( const TraceRecord& record, char* line ) {
+  const InstDetails& instr = instrs[ record.opcode ];
+  u8 parm1 = record.params[ 0 ];
+  u8 parm2 = record.params[ 1 ];
+  u16 data16 = ( parm2 << 8 ) | parm1;
+  auto flags = record.AF & 0xff;
+
+  char* p = line;
+
+  // display the regisgers
+  p = putText( p, "AF:" );
+  p = putHex( p, record.AF, 4 );
+  p = putText( p, " BC:" );
+  p = putHex( p, record.BC, 4 );
+  p = putText( p, " DE:" );
+  p = putHex( p, record.DE, 4 );
+  p = putText( p, " HL:" );
+  p = putHex( p, record.HL, 4 );
+  p = putText( p, " PC:" );
+  p = putHex( p, record.nextPC, 4 );
+  p = putText( p, " SP:" );
+  p = putHex( p, record.SP, 4 );
+  *p++ = ' ';
+  *p++ = ( flags & Zmask ) > 0 ? 'Z' : 'z';
+  *p++ = ( flags & Nmask ) > 0 ? 'N' : 'n';
+  *p++ = ( flags & Hmask ) > 0 ? 'H' : 'h';
+  *p++ = ( flags & Cmask ) > 0 ? 'C' : 'c';
+  p = putText( p, "  " );
+  p = std::to_chars( p, line + traceLineSize, record.tick ).ptr;
+  p = putText( p, " ticks\n0x" );
+
+  p = putHex( p, record.pc, 4 );
+  p = putText( p, ":  " );
+  p = putHex( p, instr.binary, 2 );
 
   if( instr.bytes == 1 ) {
-    offset += sprintf( buffer + offset, "\t\t" );
+    p = putText( p, "\t\t" );
   }
   else if ( instr.bytes == 2 ) {
-    offset += sprintf( buffer + offset, " %02x\t\t", parm1 );
+    *p++ = ' ';
+    p = putHex( p, parm1, 2 );
+    p = putText( p, "\t\t" );
   }
   else if( instr.bytes == 3 ) {
-    offset += sprintf( buffer + offset, " %02x %02x\t", parm1, parm2 );
+    *p++ = ' ';
+    p = putHex( p, parm1, 2 );
+    *p++ = ' ';
+    p = putHex( p, parm2, 2 );
+    *p++ = '\t';
   }
 
-  offset += sprintf( buffer + offset, "  %s", outline.c_str() );
+  p = putText( p, "  " );
+
+  for( auto& piece : descTemplates[ record.opcode ] ) {
+    switch( piece.slot ) {
+    case DescPiece::literal:
+      p = putText( p, piece.text );
+      break;
+
+    case DescPiece::d8:
+    case DescPiece::a8:
+      p = putHex( p, parm1, 2 );
+      break;
+
+    case DescPiece::d16:
+    case DescPiece::a16:
+      p = putHex( p, data16, 4 );
+      break;
+
+    case DescPiece::r8: {
+      int offset = static_cast< i8 >( parm1 );
+      if( offset < 0 ) {
+        *p++ = '-';
+        offset = -offset;
+      }
+      p = putHex( p, offset, 1 );
+      break;
+    }
+    }
+  }
 
-  return buffer;
+  return p;
 }
 
 // This method halts everything until it return.
@@ -158,27 +404,27 @@ CPU::debug( const InstDetails& instr, u8 parm1, u8 parm2 ) {
 }
 
 std::string
-CPU::debugGameboyDoctor(const InstDetails&, u8, u8) {
-  char buffer[ 1024 ] = { 0 };
-
-  sprintf(buffer,
-          "A:%02x F:%02x B:%02x C:%02x D:%02x E:%02x H:%02x L:%02x "
-          "SP:%04x PC:%04x PCMEM:%02x,%02x,%02x,%02x",
-          regs.A, regs.F, regs.B, regs.C, regs.D, regs.E, regs.H, regs.L,
-          regs.SP, addrCurrentInstr,
-          bus->read( addrCurrentInstr ), bus->read( addrCurrentInstr + 1),
-          bus->read( addrCurrentInstr + 2), bus->read( addrCurrentInstr + 3) );
+CPU::debugGameboyDoctor( const TraceRecord& record ) {
+  char line[ traceLineSize ];
+  return std::string( line, formatGameboyDoctor( record, line ) );
+}
 
-  return buffer;
+char*
+CPU::formatGameboyDoctor( const TraceRecord& record, char* line ) {
+  int length = snprintf( line, traceLineSize,
+                         "A:%02x F:%02x B:%02x C:%02x D:%02x E:%02x H:%02x L:%02x "
+                         "SP:%04x PC:%04x PCMEM:%02x,%02x,%02x,%02x",
+                         record.AF >> 8, record.AF & 0xff, record.BC >> 8, record.BC & 0xff,
+                         record.DE >> 8, record.DE & 0xff, record.HL >> 8, record.HL & 0xff,
+                         record.SP, record.pc,
+                         record.pcmem[ 0 ], record.pcmem[ 1 ], record.pcmem[ 2 ], record.pcmem[ 3 ] );
+
+  return line + length;
 }
 
 bool
 CPU::dbgStep( std::stringstream& is ) {
-  auto i = std::find( preExec.begin(), preExec.end(), &CPU::Step );
-
-  if( i == preExec.end() ) {
-    preExec.push_back( &CPU::Step );
-  }
+  stopAtNextInstruction();
 
   return true;
 }
@@ -195,19 +441,48 @@ CPU::dbgDump( std::stringstream& is ) {
 
 bool
 CPU::dbgBreak( std::stringstream& is ) {
+  std::string breakpoint;
+  std::getline( is, breakpoint );
+
+  breakpoint.erase( 0, breakpoint.find_first_not_of( " \t" ) );
+  if( breakpoint.empty() ) {
+    std::cout << breakpoints.list();
+    return false;
+  }
+
+  try {
+    breakpoints.add( breakpoint );
+    std::cout << "breakpoint set at " << breakpoint << std::endl;
+  }
+  catch( std::runtime_error& e ) {
+    std::cout << e.what() << std::endl;
+  }
+
+  return false;
+}
+
+bool
+CPU::dbgDelete( std::stringstream& is ) {
   u16 addr;
   is >> std::hex >> addr;
-  breakpoints[ addr ] =  bus->read( addr );
-  bus->dbgWrite( addr, debugOpcode );
-  std::cout << "breakpoint set at address " << setHex( 4 ) << addr <<
-    std::endl;
+
+  if( is.fail() ) {
+    breakpoints.clear();
+    std::cout << "all breakpoints deleted" << std::endl;
+  }
+  else if( breakpoints.remove( addr ) ) {
+    std::cout << "breakpoint at address " << setHex( 4 ) << addr << " deleted" << std::endl;
+  }
+  else {
+    std::cout << "No breakpoint at address " << setHex( 4 ) << addr << std::endl;
+  }
 
   return false;
 }
 
 bool
 CPU::dbgContinue( std::stringstream& is ) {
-    if( breakpoints.size() > 0 ) {
+    if( !breakpoints.empty() ) {
       auto i = std::find( preExec.begin(), preExec.end(), &CPU::Step );
       preExec.erase( i );
       return true;
@@ -218,6 +493,27 @@ CPU::dbgContinue( std::stringstream& is ) {
     }
 }
 
+// Going back abandons the instruction being shown, so Board::_clock takes over from here
+bool
+CPU::dbgReverseStep( std::stringstream& is ) {
+  if( rewind == nullptr || !rewind->canReverse() ) {
+    std::cout << ( rewind ? "No snapshot before this instruction" : "Set Rewind to go backwards" ) << std::endl;
+    return false;
+  }
+
+  throw Rewind::Request{ Rewind::step };
+}
+
+bool
+CPU::dbgReverseContinue( std::stringstream& is ) {
+  if( rewind == nullptr || !rewind->canReverse() ) {
+    std::cout << ( rewind ? "No snapshot before this instruction" : "Set Rewind to go backwards" ) << std::endl;
+    return false;
+  }
+
+  throw Rewind::Request{ Rewind::toBreakpoint };
+}
+
 bool
 CPU::dbgPoke( std::stringstream& is ) {
   u16 addr;
@@ -269,11 +565,7 @@ CPU::decode() {
 
 void CPU::prefixDecode() {
   addrCurrentInstr = regs.PC;
-  u16 ins = bus->read( regs.PC++ );
-
-  if( ins != debugOpcode ) {
-    ins |= 0b1'0000'0000;
-  }
+  u16 ins = bus->read( regs.PC++ ) | 0b1'0000'0000;
 
   ins_decode = instrs[ins];
 
@@ -288,7 +580,23 @@ void CPU::prefixDecode() {
 
 void
 CPU::Trace() {
-  trace << ( this->*tracer )( ins_decode, params[0], params[1] ) << std::endl;
+  if( traceFilter.isEnabled() && !traceFilter.accept( addrCurrentInstr, ticks ) ) {
+    return;
+  }
+
+  if( traceWriter ) {
+    traceWriter->submit( traceRecord( ins_decode, params[ 0 ], params[ 1 ] ) );
+    return;
+  }
+
+  char* end = ( this->*tracer )( traceRecord( ins_decode, params[ 0 ], params[ 1 ] ), traceLine );
+  *end++ = '\n';
+  trace.write( traceLine, end - traceLine );
+}
+
+void
+CPU::Doctor() {
+  doctor->check( traceRecord( ins_decode, params[ 0 ], params[ 1 ] ) );
 }
 
 void
@@ -296,6 +604,11 @@ CPU::Step() {
   debug(ins_decode, params[0], params[1]);
 }
 
+void
+CPU::RecordFetch() {
+  replayLog->push_back( ticks );
+}
+
 void CPU::_clock() {
   ticks++;
 
@@ -304,6 +617,32 @@ void CPU::_clock() {
 
     ( this->*decodeHandle )();
 
+    if( recorder ) {
+      recorder->instruction( ticks, addrCurrentInstr, ins_decode.binary, regs.AF, regs.BC, regs.DE,
+                             regs.HL, regs.SP, params[ 0 ], params[ 1 ] );
+    }
+
+    if( gdb ) {
+      // Never between a 0xcb prefix and the rest of its instruction
+      if( ( gdb->stopRequested() || breakpoints.hit( addrCurrentInstr, *this ) ) &&
+          ins_decode.binary < 0x100 && gdb->stop() ) {
+        regs.PC = addrCurrentInstr;
+        decode();
+      }
+    }
+    // A hit stops in the debugger the same way stepping does
+    else if( ins_decode.binary < 0x100 && breakpoints.hit( addrCurrentInstr, *this ) ) {
+      if( replaying ) {
+        if( replayLog ) {
+          replayLog->push_back( ticks );
+        }
+      }
+      else if( std::find( preExec.begin(), preExec.end(), &CPU::Step ) == preExec.end() ) {
+        std::cout << "Hit breakpoint at " << setHex( 4 ) << addrCurrentInstr << std::endl;
+        preExec.push_back( &CPU::Step );
+      }
+    }
+
     for( auto f : preExec ) {
       ( this->*f )();
     }
@@ -577,6 +916,12 @@ CPU::processInterrupts() {
   }
 }
 
+void
+CPU::call( u16 address ) {
+  push( regs.PC );
+  regs.PC = address;
+}
+
 void
 CPU::push( u16 address ) {
   // Emulating a little-endian machine on a little-endian machine can be confusing.
@@ -742,34 +1087,6 @@ CPU::OR(const InstDetails& instr, u8 parm1, u8) {
   return instr.cycles1;
 }
 
-u8
-CPU::DBG( const InstDetails& instr, u8, u8 ) {
-  // Set things up for the call to the debug display
-  u16 op_code = breakpoints[ addrCurrentInstr ];
-
-  if( prefixForAddress == addrCurrentInstr ) {
-    op_code |= 0b1'0000'0000;
-  }
-
-  ins_decode = instrs[ op_code ];
-
-  // Read arguments, if any
-  if( ins_decode.bytes > 1 ) {
-    for (auto i = 0; i < ins_decode.bytes - 1; i++) {
-      params[ i ] = bus->read( regs.PC++ );
-    }
-  }
-
-  if( trace.is_open() ) {
-    trace << debugSummary( ins_decode, params[ 0 ], params[ 1 ] ) << std::endl;
-  }
-
-  std::cout << "Hit breakpoint at " << setHex( 4 ) << addrCurrentInstr << std::endl;
-  debug( ins_decode, params[ 0 ], params[ 1 ] );
-
-  return( this->*ins_decode.impl )( ins_decode, params[ 0 ], params[ 1 ] );
-}
-
 void
 CPU::add( int parm1, int parm2, u8& result ) {
   int intResult = parm1 + parm2;
@@ -982,7 +1299,6 @@ CPU::SUB( const InstDetails& instr, u8 parm1, u8 ) {
 u8
 CPU::PREFIX(const InstDetails& instr, u8, u8) {
 
-  prefixForAddress = regs.PC;
   decodeHandle = &CPU::prefixDecode;
 
   return instr.cycles1;
@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+#include "../include/flightrecorder.hh"
+
+#include "../include/bus.hh"
+#include "../include/cpu.hh"
+
+FlightRecorder::FlightRecorder() {
+  std::size_t size = conf->GetNumber( "FlightRecorder", 65536 );
+
+  auto prefixValue = conf->GetValue( "FlightDump" );
+  if( !prefixValue.empty() ) {
+    prefix = prefixValue;
+  }
+
+  if( size == 0 ) {
+    return;
+  }
+
+  std::size_t capacity = 1;
+  while( capacity < size ) {
+    capacity <<= 1;
+  }
+
+  instructions.resize( capacity );
+  writes.resize( capacity );
+  mask = capacity - 1;
+  enabled = true;
+}
+
+void
+FlightRecorder::dump( const std::string& reason, CPU& cpu, Bus& bus, const std::string& suffix ) {
+  if( !enabled ) {
+    return;
+  }
+
+  std::string textName = prefix + suffix + ".txt";
+  std::string imageName = prefix + suffix + ".mem";
+
+  std::ofstream image( imageName, std::ios::binary | std::ios::trunc );
+  for( u32 address = 0; address < 0x10000; address++ ) {
+    image.put( static_cast< char >( bus.peek( address ) ) );
+  }
+
+  std::ofstream os( textName, std::ios::trunc );
+  if( !os.is_open() || !image.is_open() ) {
+    _log->Write( Log::error, "Unable to write the flight recorder dump " + textName );
+    return;
+  }
+
+  char buffer[ 1024 ];
+  sprintf( buffer, "Tick %lu, PC 0x%04x, ROM bank %u, AF:%04x BC:%04x DE:%04x HL:%04x SP:%04x",
+           cpu.ticks, cpu.addrCurrentInstr, bus.romBank(), cpu.regs.AF, cpu.regs.BC, cpu.regs.DE,
+           cpu.regs.HL, cpu.regs.SP );
+
+  os << "Flight recorder: " << reason << "\n" << buffer << "\n";
+  os << "Memory image in " << imageName << "\n\n";
+
+  auto opcodes = cpu.traceOpcodes();
+  u64 size = mask + 1;
+  u64 firstInstruction = instructionCount > size ? instructionCount - size : 0;
+  u64 nextWrite = writeCount > size ? writeCount - size : 0;
+
+  auto writesBefore = [ & ]( u64 tick ) {
+    for( ; nextWrite < writeCount && writes[ nextWrite & mask ].tick < tick; nextWrite++ ) {
+      auto& write = writes[ nextWrite & mask ];
+      sprintf( buffer, "        write 0x%04x = 0x%02x  at %lu", write.address, write.data, write.tick );
+      os << buffer << "\n";
+    }
+  };
+
+  for( u64 i = firstInstruction; i < instructionCount; i++ ) {
+    auto& entry = instructions[ i & mask ];
+    writesBefore( entry.tick );
+
+    // Enough of a trace record for the default trace layout
+    TraceRecord record = {};
+    record.tick = entry.tick;
+    record.pc = entry.pc;
+    record.nextPC = entry.pc + opcodes.bytes[ entry.opcode ];
+    record.opcode = entry.opcode;
+    record.AF = entry.AF;
+    record.BC = entry.BC;
+    record.DE = entry.DE;
+    record.HL = entry.HL;
+    record.SP = entry.SP;
+    record.params[ 0 ] = entry.params[ 0 ];
+    record.params[ 1 ] = entry.params[ 1 ];
+
+    os << cpu.debugSummary( record ) << "\n";
+  }
+  writesBefore( UINT64_MAX );
+
+  sprintf( buffer, "Flight recorder: %s, last %lu instructions in %s",
+           reason.c_str(), instructionCount - firstInstruction, textName.c_str() );
+  _log->Write( Log::error, buffer );
+}
@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "../include/framedump.hh"
+
+// DMG shade (0 = white .. 3 = black) to 8-bit luma
+static const u8 shadeLuma[ 4 ] = { 0xff, 0xaa, 0x55, 0x00 };
+
+FrameDump::FrameDump() {
+  auto keys = conf->GetKeys();
+
+  auto hasHashLog = std::find( keys.begin(), keys.end(), "FrameHashLog" );
+  if( hasHashLog != keys.end() ) {
+    hashLog.open( conf->GetValue( *hasHashLog ), std::ios::trunc );
+  }
+
+  auto hasVideoLog = std::find( keys.begin(), keys.end(), "VideoLog" );
+
+  if( hasVideoLog == keys.end() ) {
+    return;
+  }
+
+  fileName = conf->GetValue( *hasVideoLog );
+
+  auto extension = fileName.substr( fileName.find_last_of( '.' ) + 1 );
+  auto formatName = conf->GetValue( "VideoFormat" );
+  if( formatName.empty() ) {
+    formatName = extension;
+  }
+
+  if( formatName == "Y4M" || formatName == "y4m" ) {
+    format = y4m;
+  }
+  else if( formatName == "PNG" || formatName == "png" ) {
+    format = png;
+  }
+  else {
+    format = raw;
+  }
+
+  if( conf->GetValue( "VideoQueuePolicy" ) == "drop" ) {
+    policy = drop;
+  }
+
+  std::size_t queueSize = std::max< u64 >( conf->GetNumber( "VideoQueueSize", 16 ), 1 );
+
+  if( format != png ) {
+    os.open( fileName, std::ios::binary | std::ios::trunc );
+    if( !os.is_open() ) {
+      _log->Write( Log::error, "Unable to open video log " + fileName );
+      return;
+    }
+  }
+
+  if( format == y4m ) {
+    // 4194304 Hz / 70224 cycles per frame is the DMG refresh rate of ~59.73 Hz
+    os << "YUV4MPEG2 W" << Renderer::Width << " H" << Renderer::Height
+       << " F4194304:70224 Ip A1:1 Cmono\n";
+  }
+
+  queue = std::make_unique< SpscRing< Item > >( queueSize );
+  enabled = true;
+  worker = std::thread( &FrameDump::run, this );
+}
+
+FrameDump::~FrameDump() {
+  if( !enabled ) {
+    return;
+  }
+
+  done.store( true, std::memory_order_release );
+  worker.join();
+
+  char buffer[ 1024 ] = { 0 };
+  sprintf( buffer, "Frame dump wrote %lu of %lu frames to %s, %lu repeated, dropped %lu",
+           framesWritten, framesSubmitted, fileName.c_str(), framesRepeated, framesDropped );
+  _log->Write( Log::info, buffer );
+}
+
+void
+FrameDump::submit( const Renderer::Frame& frame, u64 number, u64 hash, bool duplicate ) {
+  if( hashLog.is_open() ) {
+    char line[ 64 ];
+    int length = sprintf( line, "%lu %016lx%s\n", number, hash, duplicate ? " dup" : "" );
+    hashLog.write( line, length );
+  }
+
+  if( !enabled ) {
+    return;
+  }
+
+  framesSubmitted++;
+
+  // If the previous frame never reached the worker there is nothing for it to repeat
+  duplicate = duplicate && !lastDropped;
+  lastDropped = false;
+
+  if( duplicate ) {
+    framesRepeated++;
+
+    // Numbered PNGs leave a gap in the sequence for a repeated frame
+    if( format == png ) {
+      return;
+    }
+  }
+
+  auto slot = queue->reserve();
+  while( slot == nullptr ) {
+    if( policy == drop ) {
+      framesDropped++;
+      lastDropped = true;
+      return;
+    }
+
+    std::this_thread::yield();
+    slot = queue->reserve();
+  }
+
+  slot->number = number;
+  slot->repeat = duplicate;
+  if( !duplicate ) {
+    slot->frame = frame;
+  }
+  queue->commit();
+}
+
+void
+FrameDump::run() {
+  for( ;; ) {
+    auto item = queue->front();
+
+    if( item != nullptr ) {
+      write( *item );
+      queue->release();
+    }
+    else if( done.load( std::memory_order_acquire ) ) {
+      // The producer has stopped; one more look at the queue drains anything left
+      if( queue->empty() ) {
+        break;
+      }
+    }
+    else {
+      std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+    }
+  }
+
+  os.flush();
+}
+
+void
+FrameDump::write( const Item& item ) {
+  if( format == png ) {
+    writePNG( item.frame, item.number );
+  }
+  else {
+    // A repeated frame reuses the luma of the last one written
+    if( !item.repeat ) {
+      for( std::size_t i = 0; i < item.frame.size(); i++ ) {
+        luma[ i ] = shadeLuma[ item.frame[ i ] & 0x3 ];
+      }
+    }
+
+    if( format == y4m ) {
+      os << "FRAME\n";
+    }
+    os.write( luma, sizeof( luma ) );
+  }
+
+  framesWritten++;
+}
+
+std::string
+FrameDump::pngFileName( u64 number ) {
+  auto dot = fileName.find_last_of( '.' );
+  char suffix[ 32 ];
+  sprintf( suffix, "-%06lu", number );
+
+  if( dot == std::string::npos ) {
+    return fileName + suffix + ".png";
+  }
+
+  return fileName.substr( 0, dot ) + suffix + fileName.substr( dot );
+}
+
+// Built at compile time, so the PNG writers of two Boards can share it without a race
+struct Crc32Table {
+  u32 entries[ 256 ] = {};
+
+  constexpr Crc32Table() {
+    for( u32 n = 0; n < 256; n++ ) {
+      u32 c = n;
+      for( int k = 0; k < 8; k++ ) {
+        c = ( c & 1 ) ? 0xedb88320 ^ ( c >> 1 ) : c >> 1;
+      }
+      entries[ n ] = c;
+    }
+  }
+};
+
+static constexpr Crc32Table crcTable;
+
+static u32
+crc32( const u8* data, std::size_t length, u32 crc = 0 ) {
+  crc = ~crc;
+  for( std::size_t i = 0; i < length; i++ ) {
+    crc = crcTable.entries[ ( crc ^ data[ i ] ) & 0xff ] ^ ( crc >> 8 );
+  }
+
+  return ~crc;
+}
+
+static void
+putBE32( std::vector< u8 >& v, u32 value ) {
+  v.push_back( value >> 24 );
+  v.push_back( value >> 16 );
+  v.push_back( value >> 8 );
+  v.push_back( value );
+}
+
+static void
+writeChunk( std::ofstream& os, const char* type, const std::vector< u8 >& data ) {
+  std::vector< u8 > chunk;
+  putBE32( chunk, data.size() );
+  chunk.insert( chunk.end(), type, type + 4 );
+  chunk.insert( chunk.end(), data.begin(), data.end() );
+  putBE32( chunk, crc32( chunk.data() + 4, chunk.size() - 4 ) );
+
+  os.write( reinterpret_cast< const char* >( chunk.data() ), chunk.size() );
+}
+
+// Writes an 8-bit grayscale PNG.  The image is small enough to fit in a single stored
+// (uncompressed) deflate block, so no compression library is needed.
+void
+FrameDump::writePNG( const Renderer::Frame& frame, u64 number ) {
+  std::ofstream out{ pngFileName( number ), std::ios::binary | std::ios::trunc };
+
+  static const u8 signature[ 8 ] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+  out.write( reinterpret_cast< const char* >( signature ), sizeof( signature ) );
+
+  std::vector< u8 > header;
+  putBE32( header, Renderer::Width );
+  putBE32( header, Renderer::Height );
+  header.insert( header.end(), { 8, 0, 0, 0, 0 } );  // 8-bit gray, no interlace
+  writeChunk( out, "IHDR", header );
+
+  // Each scanline is preceded by filter type 0
+  std::vector< u8 > raw;
+  raw.reserve( ( Renderer::Width + 1 ) * Renderer::Height );
+  for( int y = 0; y < Renderer::Height; y++ ) {
+    raw.push_back( 0 );
+    for( int x = 0; x < Renderer::Width; x++ ) {
+      raw.push_back( shadeLuma[ frame[ y * Renderer::Width + x ] & 0x3 ] );
+    }
+  }
+
+  u32 a = 1, b = 0;
+  for( auto byte : raw ) {
+    a = ( a + byte ) % 65521;
+    b = ( b + a ) % 65521;
+  }
+
+  std::vector< u8 > zlib{ 0x78, 0x01, 0x01 };  // zlib header, final stored block
+  u16 length = raw.size();
+  zlib.insert( zlib.end(), { static_cast< u8 >( length ), static_cast< u8 >( length >> 8 ),
+                             static_cast< u8 >( ~length ), static_cast< u8 >( ~length >> 8 ) } );
+  zlib.insert( zlib.end(), raw.begin(), raw.end() );
+  putBE32( zlib, ( b << 16 ) | a );
+  writeChunk( out, "IDAT", zlib );
+
+  writeChunk( out, "IEND", {} );
+}
@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include "../include/gbdoccompare.hh"
+
+GBDocCompare::GBDocCompare( const std::string& fileName, Formatter format )
+  : fileName( fileName ), format( format ) {
+  contextSize = std::max< u64 >( conf->GetNumber( "DoctorContext", contextSize ), 1 );
+  history.resize( contextSize );
+
+  piped = fileName.size() > 3 && fileName.compare( fileName.size() - 3, 3, ".gz" ) == 0;
+  if( piped ) {
+    std::string command = "gzip -dc '" + fileName + "'";
+    is = popen( command.c_str(), "r" );
+  }
+  else {
+    is = fopen( fileName.c_str(), "r" );
+  }
+
+  if( is == nullptr ) {
+    throw std::runtime_error( "Unable to open Gameboy Doctor log " + fileName + ": " + strerror( errno ) );
+  }
+
+  _log->Write( Log::info, "Comparing against Gameboy Doctor log " + fileName );
+}
+
+GBDocCompare::~GBDocCompare() {
+  if( is == nullptr ) {
+    // Already closed at the end of the reference
+  }
+  else if( piped ) {
+    // gzip gets SIGPIPE if the run stopped before the end; that's expected
+    pclose( is );
+  }
+  else {
+    fclose( is );
+  }
+  free( line );
+}
+
+bool
+GBDocCompare::check( const TraceRecord& record ) {
+  if( outcome != running ) {
+    return false;
+  }
+
+  ssize_t length = getline( &line, &lineCapacity, is );
+  if( length < 0 ) {
+    endOfReference();
+    return false;
+  }
+
+  Expected expected;
+  bool parsed = parse( line, expected );
+
+  u8 actual[ 8 ] = {
+    static_cast< u8 >( record.AF >> 8 ), static_cast< u8 >( record.AF ),
+    static_cast< u8 >( record.BC >> 8 ), static_cast< u8 >( record.BC ),
+    static_cast< u8 >( record.DE >> 8 ), static_cast< u8 >( record.DE ),
+    static_cast< u8 >( record.HL >> 8 ), static_cast< u8 >( record.HL )
+  };
+
+  if( !parsed ||
+      std::memcmp( actual, expected.regs, sizeof( actual ) ) != 0 ||
+      record.SP != expected.SP || record.pc != expected.PC ||
+      std::memcmp( record.pcmem, expected.pcmem, sizeof( record.pcmem ) ) != 0 ) {
+    outcome = diverged;
+    report( record, expected, parsed );
+    return false;
+  }
+
+  history[ matchedLines % contextSize ] = record;
+  matchedLines++;
+  return true;
+}
+
+// A missing, corrupt or truncated .gz only shows in gzip's exit status, so it is checked
+// here rather than taken as the end of a good reference
+void
+GBDocCompare::endOfReference() {
+  bool failed = std::ferror( is ) != 0;
+  if( piped ) {
+    int status = pclose( is );
+    failed = failed || status != 0;
+  }
+  else {
+    fclose( is );
+  }
+  is = nullptr;
+
+  if( failed || matchedLines == 0 ) {
+    outcome = unreadable;
+    _log->Write( Log::error, "Gameboy Doctor: unable to read " + fileName +
+                             ( failed ? "" : ", it has no lines" ) );
+  }
+  else {
+    outcome = matched;
+  }
+}
+
+static const char*
+parseHex( const char* p, unsigned& value ) {
+  char* end;
+  value = std::strtoul( p, &end, 16 );
+  return end == p ? nullptr : end;
+}
+
+// Expects "A:01 F:B0 B:00 C:13 D:00 E:D8 H:01 L:4D SP:FFFE PC:0100 PCMEM:00,C3,13,02"
+bool
+GBDocCompare::parse( const char* p, Expected& expected ) {
+  static const char* names[] = { "A:", "F:", "B:", "C:", "D:", "E:", "H:", "L:", "SP:", "PC:" };
+  unsigned values[ 10 ];
+
+  for( int i = 0; i < 10; i++ ) {
+    while( *p == ' ' ) {
+      p++;
+    }
+
+    auto size = std::strlen( names[ i ] );
+    if( std::strncmp( p, names[ i ], size ) != 0 || !( p = parseHex( p + size, values[ i ] ) ) ) {
+      return false;
+    }
+  }
+
+  while( *p == ' ' ) {
+    p++;
+  }
+  if( std::strncmp( p, "PCMEM:", 6 ) != 0 ) {
+    return false;
+  }
+  p += 6;
+
+  for( int i = 0; i < 4; i++ ) {
+    unsigned value;
+    if( ( i > 0 && *p++ != ',' ) || !( p = parseHex( p, value ) ) ) {
+      return false;
+    }
+    expected.pcmem[ i ] = value;
+  }
+
+  for( int i = 0; i < 8; i++ ) {
+    expected.regs[ i ] = values[ i ];
+  }
+  expected.SP = values[ 8 ];
+  expected.PC = values[ 9 ];
+
+  return true;
+}
+
+void
+GBDocCompare::report( const TraceRecord& record, const Expected& expected, bool parsed ) {
+  std::stringstream ss;
+  ss << "Gameboy Doctor: differs from " << fileName << " at line " << std::dec << matchedLines + 1
+     << ", tick " << record.tick;
+  _log->Write( Log::error, ss.str() );
+
+  u64 first = matchedLines > contextSize ? matchedLines - contextSize : 0;
+  for( u64 i = first; i < matchedLines; i++ ) {
+    _log->Write( Log::error, "  " + std::to_string( i + 1 ) + ":   " + format( history[ i % contextSize ] ) );
+  }
+
+  std::string text{ line };
+  while( !text.empty() && ( text.back() == '\n' || text.back() == '\r' ) ) {
+    text.pop_back();
+  }
+  _log->Write( Log::error, "  expected: " + text );
+  _log->Write( Log::error, "  actual:   " + format( record ) );
+
+  if( !parsed ) {
+    _log->Write( Log::error, "  the reference line isn't in Gameboy Doctor format" );
+    return;
+  }
+
+  static const char* names[] = { "A", "F", "B", "C", "D", "E", "H", "L" };
+  u16 actual[ 8 ] = {
+    static_cast< u16 >( record.AF >> 8 ), static_cast< u16 >( record.AF & 0xff ),
+    static_cast< u16 >( record.BC >> 8 ), static_cast< u16 >( record.BC & 0xff ),
+    static_cast< u16 >( record.DE >> 8 ), static_cast< u16 >( record.DE & 0xff ),
+    static_cast< u16 >( record.HL >> 8 ), static_cast< u16 >( record.HL & 0xff )
+  };
+
+  std::string differences;
+  for( int i = 0; i < 8; i++ ) {
+    if( actual[ i ] != expected.regs[ i ] ) {
+      differences += std::string( " " ) + names[ i ];
+    }
+  }
+  if( record.SP != expected.SP ) {
+    differences += " SP";
+  }
+  if( record.pc != expected.PC ) {
+    differences += " PC";
+  }
+  if( std::memcmp( record.pcmem, expected.pcmem, sizeof( record.pcmem ) ) != 0 ) {
+    differences += " PCMEM";
+  }
+  _log->Write( Log::error, "  differs in:" + differences );
+}
+
+const char*
+GBDocCompare::name( Result result ) {
+  switch( result ) {
+  case matched:
+    return "matched";
+  case diverged:
+    return "diverged";
+  case unreadable:
+    return "unreadable";
+  default:
+    return "running";
+  }
+}
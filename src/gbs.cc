@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+#include "../include/gbs.hh"
+
+static u16
+word( const std::vector< char >& bytes, std::size_t offset ) {
+  return ( bytes[ offset ] & 0xff ) | ( ( bytes[ offset + 1 ] & 0xff ) << 8 );
+}
+
+static std::string
+text( const std::vector< char >& bytes, std::size_t offset ) {
+  auto start = bytes.begin() + offset;
+  return std::string( start, std::find( start, start + 32, '\0' ) );
+}
+
+GBS::GBS( const std::string& fileName ) {
+  std::vector< char > bytes;
+
+  try {
+    auto fileSize{ fs::file_size( fs::path{ fileName } ) };
+    bytes.resize( fileSize );
+
+    std::ifstream inFile{ fileName, std::ios::binary };
+    inFile.read( bytes.data(), fileSize );
+  }
+  catch( std::exception& ) {
+    throw std::runtime_error( "Unable to open GBS file " + fileName );
+  }
+
+  if( bytes.size() < headerSize || bytes[ 0 ] != 'G' || bytes[ 1 ] != 'B' || bytes[ 2 ] != 'S' ) {
+    throw std::runtime_error( fileName + " is not a GBS file" );
+  }
+
+  if( bytes[ 3 ] != 1 ) {
+    char buffer[ 1024 ] = { 0 };
+    sprintf( buffer, "Unsupported GBS version %d in %s", bytes[ 3 ], fileName.c_str() );
+    throw std::runtime_error( buffer );
+  }
+
+  trackCount = bytes[ 0x04 ];
+  firstTrack = bytes[ 0x05 ];
+  loadAddress = word( bytes, 0x06 );
+  initAddress = word( bytes, 0x08 );
+  playAddress = word( bytes, 0x0a );
+  stackPointer = word( bytes, 0x0c );
+  timerModulo = bytes[ 0x0e ];
+  timerControl = bytes[ 0x0f ];
+  title = text( bytes, 0x10 );
+  author = text( bytes, 0x30 );
+  copyright = text( bytes, 0x50 );
+
+  if( loadAddress < 0x0400 || loadAddress > 0x7fff ) {
+    char buffer[ 1024 ] = { 0 };
+    sprintf( buffer, "GBS load address 0x%04x is outside cartridge ROM", loadAddress );
+    throw std::runtime_error( buffer );
+  }
+
+  data.assign( bytes.begin() + headerSize, bytes.end() );
+}
+
+std::vector< char >
+GBS::image() const {
+  std::size_t size = std::max< std::size_t >( 0x8000, loadAddress + data.size() );
+  size = ( size + 0x3fff ) & ~static_cast< std::size_t >( 0x3fff );
+
+  std::vector< char > rom( size, 0 );
+  std::copy( data.begin(), data.end(), rom.begin() + loadAddress );
+
+  // JP loadAddress + vector at the 8 RST vectors and the 5 interrupt vectors
+  for( u16 vector = 0x00; vector <= 0x60; vector += 8 ) {
+    u16 target = loadAddress + vector;
+    rom[ vector ] = static_cast< char >( 0xc3 );
+    rom[ vector + 1 ] = static_cast< char >( target & 0xff );
+    rom[ vector + 2 ] = static_cast< char >( target >> 8 );
+  }
+
+  // JR -2, where the routines return to
+  rom[ returnAddress ] = 0x18;
+  rom[ returnAddress + 1 ] = static_cast< char >( 0xfe );
+
+  return rom;
+}
+
+u32
+GBS::playPeriod() const {
+  if( ( timerControl & 0x04 ) == 0 ) {
+    return 70224;  // VBlank
+  }
+
+  // T-cycles per TIMA increment for each TAC clock select
+  static const u32 increment[ 4 ] = { 1024, 16, 64, 256 };
+  return increment[ timerControl & 0x3 ] * ( 256 - timerModulo );
+}
@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+#include "../include/gbsplayer.hh"
+
+#include "../include/audiolog.hh"
+#include "../include/board.hh"
+#include "../include/bus.hh"
+#include "../include/config.hh"
+#include "../include/cpu.hh"
+
+// Keys the track Boards don't see
+static const char* ignoredKeys[] = {
+  "StartInDebug", "Breakpoints", "GdbStub", "GdbWait", "Rewind", "LoadState", "SaveState",
+  "SaveStateAt", "TraceLog", "DoctorLog", "VideoLog", "FrameHashLog", "AudioLog", "SerialLog",
+  "LinkSocket"
+};
+
+GBSPlayer::GBSPlayer() {
+  fileName = conf->GetValue( "GBS" );
+
+  outputName = conf->GetValue( "GBSOutput" );
+  if( outputName.empty() ) {
+    outputName = fileName.substr( 0, fileName.find_last_of( '.' ) );
+  }
+
+  seconds = std::max< u64 >( conf->GetNumber( "GBSSeconds", seconds ), 1 );
+}
+
+int
+GBSPlayer::run() {
+  Config trackConf{ *conf };
+  auto keys = conf->GetKeys();
+  for( auto key : ignoredKeys ) {
+    if( std::find( keys.begin(), keys.end(), key ) != keys.end() ) {
+      _log->Write( Log::warn, std::string( "GBS mode ignores " ) + key );
+      trackConf.RemoveKey( key );
+    }
+  }
+
+  Config* mainConf = conf;
+  conf = &trackConf;
+  int status = renderTracks();
+  conf = mainConf;
+
+  return status;
+}
+
+int
+GBSPlayer::renderTracks() {
+  char buffer[ 1024 ] = { 0 };
+  int failed = 0;
+
+  try {
+    GBS gbs( fileName );
+
+    sprintf( buffer, "GBS %s: \"%s\" by %s, %s; %d tracks, play every %u cycles",
+             fileName.c_str(), gbs.title.c_str(), gbs.author.c_str(), gbs.copyright.c_str(),
+             gbs.trackCount, gbs.playPeriod() );
+    _log->Write( Log::info, buffer );
+
+    for( int track = 0; track < gbs.trackCount; track++ ) {
+      sprintf( buffer, "%s-%02d.wav", outputName.c_str(), track + 1 );
+
+      try {
+        renderTrack( gbs, track, buffer );
+      }
+      catch( std::runtime_error& ex ) {
+        // A track that breaks the emulator shouldn't stop the rest from being rendered
+        _log->Write( Log::error, std::string( "GBS track " ) + std::to_string( track + 1 ) +
+                     ": " + ex.what() );
+        failed++;
+      }
+    }
+  }
+  catch( std::runtime_error& ex ) {
+    _log->Write( Log::error, ex.what() );
+    return 1;
+  }
+
+  return failed > 0 ? 1 : 0;
+}
+
+void
+GBSPlayer::renderTrack( const GBS& gbs, int track, const std::string& wavName ) {
+  Board board;
+  AudioLog audioLog( wavName, AudioLog::wav );
+  CPU& cpu = board.getCpu();
+
+  board.loadCartridge( gbs.image() );
+  board.setAudioLog( &audioLog );
+
+  board.write8( Bus::IOAddress::NR52, 0x80 );
+  board.write8( Bus::IOAddress::TMA, gbs.timerModulo );
+  board.write8( Bus::IOAddress::TAC, gbs.timerControl );
+
+  cpu.regs.SP = gbs.stackPointer;
+  cpu.regs.A = track;
+  cpu.regs.PC = GBS::returnAddress;
+  cpu.call( gbs.initAddress );
+
+  u32 period = gbs.playPeriod();
+  u64 end = cpu.ticks + seconds * 4194304;
+  u64 nextPlay = cpu.ticks + period;
+
+  while( cpu.ticks < end ) {
+    // Only call play once the previous routine has returned; if it overran, the calls it
+    // missed are skipped rather than bunched up
+    if( cpu.ticks >= nextPlay && cpu.atInstructionBoundary() && cpu.regs.PC == GBS::returnAddress ) {
+      cpu.call( gbs.playAddress );
+      while( nextPlay <= cpu.ticks ) {
+        nextPlay += period;
+      }
+    }
+
+    board._clock();
+  }
+
+  char buffer[ 1024 ] = { 0 };
+  sprintf( buffer, "GBS track %d rendered to %s", track + 1, wavName.c_str() );
+  _log->Write( Log::info, buffer );
+}
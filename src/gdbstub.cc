@@ -0,0 +1,645 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../include/gdbstub.hh"
+
+#include "../include/bus.hh"
+#include "../include/cpu.hh"
+
+// How often the socket thread looks at the done flag while it waits for data
+static const int pollMilliseconds = 100;
+
+static const int registerCount = 6;
+static const std::size_t maxMemoryRead = 2048;
+
+static const char targetXml[] =
+  "<?xml version=\"1.0\"?>\n"
+  "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">\n"
+  "<target version=\"1.0\">\n"
+  "  <feature name=\"org.gnu.gdb.sm83.core\">\n"
+  "    <reg name=\"af\" bitsize=\"16\" type=\"int\"/>\n"
+  "    <reg name=\"bc\" bitsize=\"16\" type=\"int\"/>\n"
+  "    <reg name=\"de\" bitsize=\"16\" type=\"int\"/>\n"
+  "    <reg name=\"hl\" bitsize=\"16\" type=\"int\"/>\n"
+  "    <reg name=\"sp\" bitsize=\"16\" type=\"data_ptr\"/>\n"
+  "    <reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\"/>\n"
+  "  </feature>\n"
+  "</target>\n";
+
+static void
+putHex8( std::string& out, u8 value ) {
+  static const char hexDigits[] = "0123456789abcdef";
+  out += hexDigits[ value >> 4 ];
+  out += hexDigits[ value & 0xf ];
+}
+
+static int
+hexValue( char c ) {
+  if( '0' <= c && c <= '9' ) {
+    return c - '0';
+  }
+  c = std::tolower( c );
+  if( 'a' <= c && c <= 'f' ) {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+static bool
+getHex8( const std::string& text, std::size_t at, u8& value ) {
+  if( at + 2 > text.size() || hexValue( text[ at ] ) < 0 || hexValue( text[ at + 1 ] ) < 0 ) {
+    return false;
+  }
+  value = hexValue( text[ at ] ) << 4 | hexValue( text[ at + 1 ] );
+  return true;
+}
+
+// All of text has to be a hex number no bigger than limit
+static bool
+getHex( const std::string& text, unsigned long limit, unsigned long& value ) {
+  if( text.empty() || !std::isxdigit( static_cast< unsigned char >( text[ 0 ] ) ) ) {
+    return false;
+  }
+
+  char* end;
+  errno = 0;
+  value = std::strtoul( text.c_str(), &end, 16 );
+  return *end == '\0' && errno == 0 && value <= limit;
+}
+
+GdbStub::GdbStub( const std::string& address, bool wait )
+  : address( address ) {
+  bool tcp = !address.empty() && address.find_first_not_of( "0123456789" ) == std::string::npos;
+
+  if( tcp ) {
+    sockaddr_in in;
+    std::memset( &in, 0, sizeof( in ) );
+    in.sin_family = AF_INET;
+    auto port = std::strtoul( address.c_str(), nullptr, 10 );
+    if( port == 0 || port > 0xffff ) {
+      throw std::runtime_error( "GdbStub port " + address + " is out of range" );
+    }
+    in.sin_port = htons( port );
+    in.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+    listener = socket( AF_INET, SOCK_STREAM, 0 );
+    int on = 1;
+    setsockopt( listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof( on ) );
+    if( listener < 0 || bind( listener, reinterpret_cast< sockaddr* >( &in ), sizeof( in ) ) < 0 ) {
+      throw std::runtime_error( "Unable to bind the GDB stub to port " + address + ": " + strerror( errno ) );
+    }
+  }
+  else {
+    sockaddr_un un;
+    if( address.size() >= sizeof( un.sun_path ) ) {
+      throw std::runtime_error( "GDB stub socket path " + address + " is too long" );
+    }
+    std::memset( &un, 0, sizeof( un ) );
+    un.sun_family = AF_UNIX;
+    std::strcpy( un.sun_path, address.c_str() );
+
+    unlink( address.c_str() );
+    listener = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if( listener < 0 || bind( listener, reinterpret_cast< sockaddr* >( &un ), sizeof( un ) ) < 0 ) {
+      throw std::runtime_error( "Unable to bind the GDB stub to " + address + ": " + strerror( errno ) );
+    }
+  }
+
+  if( ::listen( listener, 1 ) < 0 ) {
+    throw std::runtime_error( "Unable to listen on " + address + ": " + strerror( errno ) );
+  }
+
+  stopping.store( wait );
+  _log->Write( Log::info, "GDB stub listening on " + address );
+}
+
+GdbStub::~GdbStub() {
+  {
+    std::lock_guard< std::mutex > lock( mutex );
+    done.store( true );
+
+    // The run ended while the debugger was waiting for it to stop
+    if( replyPending && client >= 0 ) {
+      send( "W00" );
+      replyPending = false;
+    }
+    parkedChanged.notify_all();
+  }
+
+  if( worker.joinable() ) {
+    worker.join();
+  }
+
+  close( listener );
+  if( address.find_first_not_of( "0123456789" ) != std::string::npos ) {
+    unlink( address.c_str() );
+  }
+}
+
+void
+GdbStub::initialize( CPU* cpu, Bus* bus ) {
+  this->cpu = cpu;
+  this->bus = bus;
+
+  worker = std::thread( &GdbStub::run, this );
+}
+
+bool
+GdbStub::stop() {
+  std::unique_lock< std::mutex > lock( mutex );
+
+  parked = true;
+  changed = false;
+  stopping.store( false, std::memory_order_relaxed );
+
+  if( replyPending ) {
+    char reply[ 8 ];
+    sprintf( reply, "S%02x", signal );
+    send( reply );
+    replyPending = false;
+  }
+  parkedChanged.notify_all();
+
+  parkedChanged.wait( lock, [ this ] { return !parked; } );
+
+  return changed;
+}
+
+void
+GdbStub::run() {
+  while( !done.load() ) {
+    pollfd waiting = { listener, POLLIN, 0 };
+    if( poll( &waiting, 1, pollMilliseconds ) <= 0 ) {
+      continue;
+    }
+
+    int fd = accept( listener, nullptr, nullptr );
+    if( fd < 0 ) {
+      continue;
+    }
+
+    {
+      std::lock_guard< std::mutex > lock( mutex );
+      client = fd;
+    }
+    _log->Write( Log::info, "GDB connected on " + address );
+
+    serve();
+    release();
+
+    {
+      std::lock_guard< std::mutex > lock( mutex );
+      close( client );
+      client = -1;
+    }
+    _log->Write( Log::info, "GDB disconnected" );
+  }
+}
+
+void
+GdbStub::serve() {
+  {
+    // The debugger expects the machine to be stopped once it is attached
+    std::unique_lock< std::mutex > lock( mutex );
+    signal = sigtrap;
+    stopping.store( true );
+    waitUntilParked( lock );
+  }
+
+  enum {
+    idle,
+    body,
+    checksumHigh,
+    checksumLow
+  } state = idle;
+
+  std::string packet;
+  u8 sum = 0;
+  int checksum = 0;
+
+  while( !done.load() ) {
+    pollfd waiting = { client, POLLIN, 0 };
+    if( poll( &waiting, 1, pollMilliseconds ) <= 0 ) {
+      continue;
+    }
+
+    char buffer[ 4096 ];
+    auto count = recv( client, buffer, sizeof( buffer ), 0 );
+    if( count <= 0 ) {
+      return;
+    }
+
+    for( int i = 0; i < count; i++ ) {
+      char c = buffer[ i ];
+
+      switch( state ) {
+      case idle:
+        if( c == '$' ) {
+          packet.clear();
+          sum = 0;
+          state = body;
+        }
+        else if( c == 0x03 ) {
+          // Interrupt: stop at the next fetch and tell the debugger then
+          std::lock_guard< std::mutex > lock( mutex );
+          if( !parked ) {
+            signal = sigint;
+            stopping.store( true );
+          }
+        }
+        // + and - acknowledge what was sent; nothing is ever sent again
+        break;
+
+      case body:
+        if( c == '#' ) {
+          state = checksumHigh;
+        }
+        else {
+          packet += c;
+          sum += c;
+        }
+        break;
+
+      case checksumHigh:
+        checksum = hexValue( c ) << 4;
+        state = checksumLow;
+        break;
+
+      case checksumLow:
+        checksum |= hexValue( c );
+        state = idle;
+
+        if( checksum != sum ) {
+          sendRaw( "-" );
+          break;
+        }
+        sendRaw( "+" );
+        if( !handle( packet ) ) {
+          return;
+        }
+        break;
+      }
+    }
+  }
+}
+
+void
+GdbStub::waitUntilParked( std::unique_lock< std::mutex >& lock ) {
+  parkedChanged.wait( lock, [ this ] { return parked || done.load(); } );
+}
+
+void
+GdbStub::resume( bool step ) {
+  signal = sigtrap;
+  stopping.store( step );
+  replyPending = true;
+  parked = false;
+  parkedChanged.notify_all();
+}
+
+// The debugger went away: take its breakpoints out and let the emulator run on
+void
+GdbStub::release() {
+  std::unique_lock< std::mutex > lock( mutex );
+
+  if( !ownBreakpoints.empty() && !parked ) {
+    stopping.store( true );
+    waitUntilParked( lock );
+  }
+
+  if( parked ) {
+    for( auto address : ownBreakpoints ) {
+      cpu->getBreakpoints().remove( address );
+    }
+    ownBreakpoints.clear();
+  }
+
+  replyPending = false;
+  stopping.store( false );
+  parked = false;
+  parkedChanged.notify_all();
+}
+
+bool
+GdbStub::handle( const std::string& packet ) {
+  std::unique_lock< std::mutex > lock( mutex );
+
+  if( packet.empty() ) {
+    send( "" );
+    return true;
+  }
+
+  // In all-stop mode nothing but an interrupt comes while the emulator runs
+  if( !parked ) {
+    send( "E01" );
+    return true;
+  }
+
+  // Nothing the debugger sends may take the emulator down
+  try {
+    return dispatch( packet );
+  }
+  catch( std::exception& ex ) {
+    _log->Write( Log::warn, "GDB packet " + packet.substr( 0, 32 ) + " failed: " + ex.what() );
+    send( "E01" );
+    return true;
+  }
+}
+
+bool
+GdbStub::dispatch( const std::string& packet ) {
+  std::string arguments = packet.substr( 1 );
+
+  switch( packet[ 0 ] ) {
+  case '?': {
+    char reply[ 8 ];
+    sprintf( reply, "S%02x", signal );
+    send( reply );
+    break;
+  }
+
+  case 'g':
+    send( readRegisters() );
+    break;
+
+  case 'G':
+    for( int i = 0; i < registerCount; i++ ) {
+      u8 low, high;
+      if( !getHex8( arguments, i * 4, low ) || !getHex8( arguments, i * 4 + 2, high ) ) {
+        send( "E01" );
+        return true;
+      }
+      setRegister( i, high << 8 | low );
+    }
+    send( "OK" );
+    break;
+
+  case 'p':
+    send( readRegister( arguments ) );
+    break;
+
+  case 'P':
+    send( writeRegister( arguments ) );
+    break;
+
+  case 'm':
+    send( readMemory( arguments ) );
+    break;
+
+  case 'M':
+    send( writeMemory( arguments ) );
+    break;
+
+  case 'c':
+  case 's':
+    if( !arguments.empty() ) {
+      unsigned long address;
+      if( !getHex( arguments, 0xffff, address ) ) {
+        send( "E01" );
+        break;
+      }
+      setRegister( 5, address );
+    }
+    resume( packet[ 0 ] == 's' );
+    break;
+
+  case 'Z':
+  case 'z':
+    send( breakpoint( arguments, packet[ 0 ] == 'Z' ) );
+    break;
+
+  case 'q':
+    send( query( packet ) );
+    break;
+
+  case 'H':
+    send( "OK" );
+    break;
+
+  case 'D':
+    send( "OK" );
+    return false;
+
+  case 'k':
+    killed.store( true );
+    return false;
+
+  default:
+    // Not supported, which includes vCont
+    send( "" );
+    break;
+  }
+
+  return true;
+}
+
+u16
+GdbStub::getRegister( int index ) {
+  switch( index ) {
+  case 0: return cpu->regs.AF;
+  case 1: return cpu->regs.BC;
+  case 2: return cpu->regs.DE;
+  case 3: return cpu->regs.HL;
+  case 4: return cpu->regs.SP;
+  default: return cpu->addrCurrentInstr;  // regs.PC is already past the fetched instruction
+  }
+}
+
+void
+GdbStub::setRegister( int index, u16 value ) {
+  switch( index ) {
+  case 0: cpu->regs.AF = value & 0xfff0; break;
+  case 1: cpu->regs.BC = value; break;
+  case 2: cpu->regs.DE = value; break;
+  case 3: cpu->regs.HL = value; break;
+  case 4: cpu->regs.SP = value; break;
+  default:
+    if( value != cpu->addrCurrentInstr ) {
+      cpu->addrCurrentInstr = value;
+      changed = true;
+    }
+    break;
+  }
+}
+
+std::string
+GdbStub::readRegisters() {
+  std::string reply;
+
+  for( int i = 0; i < registerCount; i++ ) {
+    u16 value = getRegister( i );
+    putHex8( reply, value & 0xff );
+    putHex8( reply, value >> 8 );
+  }
+
+  return reply;
+}
+
+std::string
+GdbStub::readRegister( const std::string& arguments ) {
+  unsigned long index;
+  if( !getHex( arguments, registerCount - 1, index ) ) {
+    return "E01";
+  }
+
+  std::string reply;
+  u16 value = getRegister( index );
+  putHex8( reply, value & 0xff );
+  putHex8( reply, value >> 8 );
+
+  return reply;
+}
+
+std::string
+GdbStub::writeRegister( const std::string& arguments ) {
+  auto equals = arguments.find( '=' );
+  if( equals == std::string::npos ) {
+    return "E01";
+  }
+
+  unsigned long index;
+  u8 low, high;
+  if( !getHex( arguments.substr( 0, equals ), registerCount - 1, index ) || !getHex8( arguments, equals + 1, low ) ||
+      !getHex8( arguments, equals + 3, high ) ) {
+    return "E01";
+  }
+
+  setRegister( index, high << 8 | low );
+  return "OK";
+}
+
+std::string
+GdbStub::readMemory( const std::string& arguments ) {
+  unsigned address, length;
+  if( sscanf( arguments.c_str(), "%x,%x", &address, &length ) != 2 ) {
+    return "E01";
+  }
+
+  std::string reply;
+  for( unsigned i = 0; i < std::min< std::size_t >( length, maxMemoryRead ); i++ ) {
+    putHex8( reply, bus->peek( ( address + i ) & 0xffff ) );
+  }
+
+  return reply;
+}
+
+std::string
+GdbStub::writeMemory( const std::string& arguments ) {
+  unsigned address, length;
+  auto colon = arguments.find( ':' );
+  if( colon == std::string::npos || sscanf( arguments.c_str(), "%x,%x", &address, &length ) != 2 ) {
+    return "E01";
+  }
+
+  // A write below 0x8000 would go to the MBC, not the ROM
+  if( address < 0x8000 || address + length > 0x10000 ) {
+    return "E0e";
+  }
+
+  for( unsigned i = 0; i < length; i++ ) {
+    u8 data;
+    if( !getHex8( arguments, colon + 1 + i * 2, data ) ) {
+      return "E01";
+    }
+  }
+
+  for( unsigned i = 0; i < length; i++ ) {
+    u8 data;
+    getHex8( arguments, colon + 1 + i * 2, data );
+    if( !bus->poke( address + i, data ) ) {
+      changed = true;
+      return "E0e";
+    }
+  }
+  changed = true;
+
+  return "OK";
+}
+
+std::string
+GdbStub::breakpoint( const std::string& arguments, bool insert ) {
+  unsigned type, address;
+  if( sscanf( arguments.c_str(), "%x,%x", &type, &address ) != 2 || address > 0xffff ) {
+    return "E01";
+  }
+
+  // Software and hardware breakpoints are the same thing here; watchpoints aren't supported
+  if( type > 1 ) {
+    return "";
+  }
+
+  auto& breakpoints = cpu->getBreakpoints();
+  if( insert ) {
+    char text[ 8 ];
+    sprintf( text, "%x", address );
+    breakpoints.add( text );
+    ownBreakpoints.insert( address );
+  }
+  else {
+    breakpoints.remove( address );
+    ownBreakpoints.erase( address );
+  }
+
+  return "OK";
+}
+
+std::string
+GdbStub::query( const std::string& packet ) {
+  if( packet.compare( 0, 10, "qSupported" ) == 0 ) {
+    return "PacketSize=1000;qXfer:features:read+";
+  }
+
+  if( packet == "qAttached" ) {
+    return "1";
+  }
+
+  static const std::string features = "qXfer:features:read:target.xml:";
+  if( packet.compare( 0, features.size(), features ) == 0 ) {
+    unsigned offset, length;
+    if( sscanf( packet.c_str() + features.size(), "%x,%x", &offset, &length ) != 2 ) {
+      return "E01";
+    }
+
+    std::string xml = targetXml;
+    if( offset >= xml.size() ) {
+      return "l";
+    }
+    auto part = xml.substr( offset, length );
+    return ( offset + part.size() < xml.size() ? "m" : "l" ) + part;
+  }
+
+  return "";
+}
+
+void
+GdbStub::send( const std::string& packet ) {
+  u8 sum = 0;
+  for( char c : packet ) {
+    sum += c;
+  }
+
+  std::string framed = "$" + packet + "#";
+  putHex8( framed, sum );
+  sendRaw( framed );
+}
+
+void
+GdbStub::sendRaw( const std::string& data ) {
+  std::lock_guard< std::mutex > lock( sendMutex );
+
+  if( client >= 0 ) {
+    ::send( client, data.data(), data.size(), MSG_NOSIGNAL );
+  }
+}
@@ -0,0 +1,99 @@
+#include <exception>
+#include <thread>
+
+#include "../include/locallink.hh"
+
+#include "../include/board.hh"
+#include "../include/cpu.hh"
+
+LocalLink::LocalLink( u32 window )
+  : window( window ) {
+  for( int side = 0; side < 2; side++ ) {
+    ends[ side ].cable = this;
+    ends[ side ].side = side;
+  }
+}
+
+void
+LocalLink::connect( Board& first, Board& second ) {
+  boards[ 0 ] = &first;
+  boards[ 1 ] = &second;
+
+  first.connectLink( &ends[ 0 ], window );
+  second.connectLink( &ends[ 1 ], window );
+}
+
+void
+LocalLink::run( u64 cycles, bool twoThreads ) {
+  if( !twoThreads ) {
+    // Only the first Board drives the second; the second never has to wait for the first
+    ends[ 0 ].runPeer = [ this ]() { boards[ 1 ]->_clock(); };
+    ends[ 1 ].runPeer = nullptr;
+
+    runBoard( 0, cycles );
+    return;
+  }
+
+  ends[ 0 ].runPeer = ends[ 1 ].runPeer = nullptr;
+
+  std::exception_ptr errors[ 2 ];
+  auto body = [ & ]( int side ) {
+    try {
+      runBoard( side, cycles );
+    }
+    catch( ... ) {
+      errors[ side ] = std::current_exception();
+    }
+
+    // Whichever Board stops first must not leave the other waiting at a boundary
+    closed.store( true, std::memory_order_release );
+  };
+
+  std::thread second( body, 1 );
+  body( 0 );
+  second.join();
+
+  for( auto& error : errors ) {
+    if( error ) {
+      std::rethrow_exception( error );
+    }
+  }
+}
+
+void
+LocalLink::runBoard( int side, u64 cycles ) {
+  Board& board = *boards[ side ];
+  CPU& cpu = board.getCpu();
+  u64 end = cycles == 0 ? UINT64_MAX : cpu.ticks + cycles;
+
+  // Both stop as soon as either one does
+  while( cpu.ticks < end && !closed.load( std::memory_order_relaxed ) && !board.isFinished() ) {
+    board._clock();
+  }
+}
+
+bool
+LocalLink::End::exchange( const LinkMessage& out, LinkMessage& in ) {
+  window++;
+
+  Slot& mine = cable->slots[ side ];
+  mine.messages[ window & 1 ] = out;
+  mine.sequence.store( window, std::memory_order_release );
+
+  Slot& theirs = cable->slots[ 1 - side ];
+  while( theirs.sequence.load( std::memory_order_acquire ) < window ) {
+    if( cable->closed.load( std::memory_order_acquire ) ) {
+      return false;
+    }
+
+    if( runPeer ) {
+      runPeer();
+    }
+    else {
+      std::this_thread::yield();
+    }
+  }
+
+  in = theirs.messages[ window & 1 ];
+  return true;
+}
@@ -1,20 +1,120 @@
-
 #include <ctime>
 #include <string>
 
 #include "../include/log.hh"
 
-Log::Log(std::string fileName) : os{ fileName, std::ios::app } {}
+std::atomic< Log::Site* > Log::sites{ nullptr };
+
+Log::Site::Site( const char* file, int line )
+  : file( file ), line( line ) {
+  // Remember every site so suppressed counts can be reported at the end
+  next = sites.load( std::memory_order_relaxed );
+  while( !sites.compare_exchange_weak( next, this, std::memory_order_release, std::memory_order_relaxed ) ) {
+  }
+}
+
+Log::Log(std::string fileName) : os{ fileName, std::ios::app } {
+  worker = std::thread( &Log::run, this );
+}
+
+Log::~Log() {
+  reportSuppressed();
+
+  auto waited = waits.load( std::memory_order_relaxed );
+  if( waited > 0 ) {
+    Write( warn, std::to_string( waited ) + " log messages waited for room in the queue" );
+  }
+
+  done.store( true, std::memory_order_release );
+  worker.join();
+  os.close();
+}
+
+void
+Log::Write( LogType type, const std::string& message ) {
+  if( type < minimum ) {
+    return;
+  }
+
+  auto now = std::chrono::system_clock::now();
+  auto fill = [ & ]( Entry& entry ) {
+    entry.time = now;
+    entry.type = type;
+    entry.text.assign( message );  // keeps the slot's capacity after the first lap
+  };
+
+  if( !queue.tryPush( fill ) ) {
+    waits.fetch_add( 1, std::memory_order_relaxed );
+    do {
+      std::this_thread::yield();
+    } while( !queue.tryPush( fill ) );
+  }
+}
+
+bool
+Log::admit( Site& site, unsigned long& suppressed ) {
+  if( site.count.fetch_add( 1, std::memory_order_relaxed ) < siteBurst ) {
+    return true;
+  }
+
+  // Past the burst only the first message in each second gets through
+  long second = std::chrono::duration_cast< std::chrono::seconds >(
+    std::chrono::steady_clock::now().time_since_epoch() ).count();
+  long last = site.lastSecond.load( std::memory_order_relaxed );
+
+  if( second == last ||
+      !site.lastSecond.compare_exchange_strong( last, second, std::memory_order_relaxed ) ) {
+    site.suppressed.fetch_add( 1, std::memory_order_relaxed );
+    return false;
+  }
+
+  suppressed = site.suppressed.exchange( 0, std::memory_order_relaxed );
+  return true;
+}
 
-Log::~Log() { os.close(); }
+void
+Log::reportSuppressed() {
+  for( auto site = sites.load( std::memory_order_acquire ); site != nullptr; site = site->next ) {
+    auto suppressed = site->suppressed.exchange( 0, std::memory_order_relaxed );
+    if( suppressed > 0 ) {
+      Write( info, "Suppressed " + std::to_string( suppressed ) + " repeats of the message from " +
+                   site->file + ":" + std::to_string( site->line ) );
+    }
+  }
+}
 
 void
-Log::Write( LogType type, std::string message ) {
-  auto now = std::time(nullptr);
-  std::string nowLocal = std::asctime( std::localtime( &now ) );
-  nowLocal = nowLocal.substr( 0, nowLocal.length() - 1 );
+Log::run() {
+  for( ;; ) {
+    auto entry = queue.front();
+
+    if( entry != nullptr ) {
+      auto time = std::chrono::system_clock::to_time_t( entry->time );
+      std::tm local;
+      localtime_r( &time, &local );
+
+      char stamp[ 64 ];
+      strftime( stamp, sizeof( stamp ), "%a %b %e %H:%M:%S %Y", &local );
+
+      os << stamp << "|" << toString( entry->type ) << "|" << entry->text << '\n';
+      if( entry->type == error ) {
+        os.flush();
+      }
+      queue.release();
+    }
+    else if( done.load( std::memory_order_acquire ) ) {
+      // Nothing can be added once done is set; one more look drains anything left
+      if( queue.front() == nullptr ) {
+        break;
+      }
+    }
+    else {
+      os.flush();
+      std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+    }
+  }
 
-  os << nowLocal << "|" << toString( type ) << "|" << message << std::endl;
+  os.flush();
 }
 
 std::string
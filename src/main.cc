@@ -7,6 +7,8 @@
 
 #include "../include/board.hh"
 #include "../include/config.hh"
+#include "../include/gbsplayer.hh"
+#include "../include/locallink.hh"
 #include "../include/log.hh"
 
 
@@ -99,23 +101,120 @@ main( int argc, char** argv ) {
     log.Write( Log::info, "   " + key + " = " + _conf.GetValue( key ) );
   }
 
-  Board board;
+  auto keys = _conf.GetKeys();
+  if( std::find( keys.begin(), keys.end(), "GBS" ) != keys.end() ) {
+    GBSPlayer player;
+    int status = player.run();
+    log.Write( Log::info, "GameBoyEmu ended" );
+    return status;
+  }
+
+  // A bad config (a file that can't be opened, a breakpoint that doesn't parse, a saved
+  // state that won't load) throws while the boards are built
+  std::unique_ptr< Board > mainBoard;
+
+  // A second Game Boy on the other end of the link cable, set up from its own config file
+  std::unique_ptr< Board > peer;
+  std::unique_ptr< LocalLink > link;
 
   try {
-    while( true ) {
-      board._clock();
+    mainBoard = std::make_unique< Board >();
+
+    auto hasLinkLocal = std::find( keys.begin(), keys.end(), "LinkLocal" );
+    if( hasLinkLocal != keys.end() ) {
+      dictionary<> peerCmdl{ cmdl };
+      peerCmdl[ "-C" ] = _conf.GetValue( *hasLinkLocal );
+      Config peerConf{ peerCmdl };
+
+      conf = &peerConf;
+      try {
+        peer = std::make_unique< Board >();
+      }
+      catch( std::exception& ) {
+        conf = &_conf;
+        throw;
+      }
+      conf = &_conf;
+
+      link = std::make_unique< LocalLink >( _conf.GetNumber( "LinkWindow", 2048 ) );
+      link->connect( *mainBoard, *peer );
     }
   }
-  catch( std::runtime_error& ex ) {
+  catch( std::exception& ex ) {
+    log.Write( Log::error, ex.what() );
+    std::cerr << "ERROR: " << ex.what() << std::endl;
+    log.Write( Log::info, "GameBoyEmu ended" );
+    return 3;  // the same as the oracle's emulator error
+  }
+
+  Board& board = *mainBoard;
+
+  bool error = false;
+
+  try {
+    if( link ) {
+      link->run( 0, _conf.GetValue( "LinkThreads" ) == "2" );
+    }
+    else {
+      while( !board.isFinished() ) {
+        board._clock();
+      }
+    }
+  }
+  catch( std::exception& ex ) {
     std::stringstream ss;
     ss << ex.what() << ", PC = 0x" << setHex( 4 ) << board.getCpu().addrCurrentInstr;
     ss << ", On tick " << std::dec << board.getCpu().ticks;
 
     log.Write( Log::error, ss.str() );
     std::cerr << "ERROR: " << ss.str() << std::endl;
+    error = true;
+
+    board.dumpFlightRecorder( ex.what() );
+    if( peer ) {
+      peer->dumpFlightRecorder( ex.what(), "-peer" );
+    }
+  }
+
+  if( board.getOracle().verdict() == SerialOracle::timedOut ) {
+    // The cycle budget is the watchdog for runs that never report
+    board.dumpFlightRecorder( "cycle budget ran out" );
+  }
+
+  int status = 0;
+  auto& oracle = board.getOracle();
+  if( oracle.isEnabled() ) {
+    // 0 passed, 1 failed, 2 timed out, 3 the emulator stopped on an error first
+    status = error && oracle.verdict() == SerialOracle::running ? 3 : oracle.exitStatus();
+
+    std::stringstream ss;
+    ss << "Serial oracle: " << SerialOracle::name( oracle.verdict() ) << " after "
+       << board.getCpu().ticks << " ticks";
+    log.Write( Log::info, ss.str() );
+    log.Write( Log::info, "Serial output: " + oracle.tail() );
+    std::cout << SerialOracle::name( oracle.verdict() ) << std::endl;
+  }
+
+  auto doctor = board.getCpu().getDoctor();
+  if( doctor ) {
+    // 0 every line matched, 1 a difference, 3 the reference couldn't be read or the
+    // emulator stopped on an error first
+    auto result = doctor->result();
+    if( result == GBDocCompare::matched || result == GBDocCompare::diverged ) {
+      status = std::max( status, result == GBDocCompare::matched ? 0 : 1 );
+    }
+    else if( error || result == GBDocCompare::unreadable ) {
+      status = std::max( status, 3 );
+    }
+
+    std::stringstream ss;
+    ss << "Gameboy Doctor: " << GBDocCompare::name( doctor->result() ) << " after "
+       << doctor->linesMatched() << " matching lines";
+    log.Write( Log::info, ss.str() );
+    std::cout << ss.str() << std::endl;
   }
 
   log.Write( Log::info, "GameBoyEmu ended" );
 
-  return 0;
+  return status;
 }
@@ -1,7 +1,7 @@
 
 #include "../include/mbc1.hh"
 
-u16
+u32
 MBC1::getCartAddress( u16 address ) {
   if( address < 0x4000 ) {
     return address;
@@ -0,0 +1,118 @@
+#include <algorithm>
+
+#if defined( __SSE__ )
+#include <xmmintrin.h>
+#endif
+
+#include "../include/mixer.hh"
+
+Mixer::Mixer( int inputRate )
+  : leftResampler( inputRate, outputRate ),
+    rightResampler( inputRate, outputRate ) {
+  reference = conf->GetValue( "AudioKernels" ) == "scalar";
+}
+
+void
+Mixer::mix( const std::vector< float > ( &channels )[ 4 ], const std::vector< Segment >& segments ) {
+  std::size_t count = channels[ 0 ].size();
+  for( int ch = 1; ch < 4; ch++ ) {
+    count = std::min( count, channels[ ch ].size() );
+  }
+
+  left.resize( count );
+  right.resize( count );
+
+  for( std::size_t s = 0; s < segments.size(); s++ ) {
+    std::size_t start = std::min( segments[ s ].start, count );
+    std::size_t end = s + 1 < segments.size() ? std::min( segments[ s + 1 ].start, count ) : count;
+    if( start >= end ) {
+      continue;
+    }
+
+    // A channel level is at most 15 either way, so four channels at full master volume
+    // sum to 60.  NR50 volumes 0-7 scale by 1/8 .. 8/8.
+    u8 nr50 = segments[ s ].nr50;
+    u8 nr51 = segments[ s ].nr51;
+    float leftVolume = ( ( ( nr50 >> 4 ) & 0x7 ) + 1 ) / ( 8.0f * 60.0f );
+    float rightVolume = ( ( nr50 & 0x7 ) + 1 ) / ( 8.0f * 60.0f );
+
+    float leftGain[ 4 ];
+    float rightGain[ 4 ];
+    const float* blocks[ 4 ];
+    for( int ch = 0; ch < 4; ch++ ) {
+      leftGain[ ch ] = ( nr51 & ( 0x10 << ch ) ) ? leftVolume : 0.0f;
+      rightGain[ ch ] = ( nr51 & ( 0x01 << ch ) ) ? rightVolume : 0.0f;
+      blocks[ ch ] = channels[ ch ].data() + start;
+    }
+
+    if( reference ) {
+      mixBlockReference( blocks, end - start, leftGain, rightGain, left.data() + start, right.data() + start );
+    }
+    else {
+      mixBlock( blocks, end - start, leftGain, rightGain, left.data() + start, right.data() + start );
+    }
+  }
+
+  leftOut.clear();
+  rightOut.clear();
+  leftResampler.process( left.data(), count, leftOut, reference );
+  rightResampler.process( right.data(), count, rightOut, reference );
+
+  std::size_t frames = std::min( leftOut.size(), rightOut.size() );
+  stereo.resize( frames * 2 );
+  for( std::size_t i = 0; i < frames; i++ ) {
+    stereo[ i * 2 ] = leftOut[ i ];
+    stereo[ i * 2 + 1 ] = rightOut[ i ];
+  }
+}
+
+// Each output is ( ( c0 * g0 + c1 * g1 ) + c2 * g2 ) + c3 * g3, in that order, so the SIMD
+// kernel below rounds exactly the same way.
+void
+Mixer::mixBlockReference( const float* const channels[ 4 ], std::size_t count,
+                          const float leftGain[ 4 ], const float rightGain[ 4 ],
+                          float* left, float* right ) {
+  for( std::size_t i = 0; i < count; i++ ) {
+    float l = channels[ 0 ][ i ] * leftGain[ 0 ];
+    float r = channels[ 0 ][ i ] * rightGain[ 0 ];
+    for( int ch = 1; ch < 4; ch++ ) {
+      l += channels[ ch ][ i ] * leftGain[ ch ];
+      r += channels[ ch ][ i ] * rightGain[ ch ];
+    }
+    left[ i ] = l;
+    right[ i ] = r;
+  }
+}
+
+void
+Mixer::mixBlock( const float* const channels[ 4 ], std::size_t count,
+                 const float leftGain[ 4 ], const float rightGain[ 4 ],
+                 float* left, float* right ) {
+  std::size_t i = 0;
+
+#if defined( __SSE__ )
+  __m128 gl[ 4 ];
+  __m128 gr[ 4 ];
+  for( int ch = 0; ch < 4; ch++ ) {
+    gl[ ch ] = _mm_set1_ps( leftGain[ ch ] );
+    gr[ ch ] = _mm_set1_ps( rightGain[ ch ] );
+  }
+
+  for( ; i + 4 <= count; i += 4 ) {
+    __m128 c = _mm_loadu_ps( channels[ 0 ] + i );
+    __m128 l = _mm_mul_ps( c, gl[ 0 ] );
+    __m128 r = _mm_mul_ps( c, gr[ 0 ] );
+    for( int ch = 1; ch < 4; ch++ ) {
+      c = _mm_loadu_ps( channels[ ch ] + i );
+      l = _mm_add_ps( l, _mm_mul_ps( c, gl[ ch ] ) );
+      r = _mm_add_ps( r, _mm_mul_ps( c, gr[ ch ] ) );
+    }
+    _mm_storeu_ps( left + i, l );
+    _mm_storeu_ps( right + i, r );
+  }
+#endif
+
+  // Whatever doesn't fill a vector
+  const float* const rest[ 4 ] = { channels[ 0 ] + i, channels[ 1 ] + i, channels[ 2 ] + i, channels[ 3 ] + i };
+  mixBlockReference( rest, count - i, leftGain, rightGain, left + i, right + i );
+}
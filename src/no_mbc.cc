@@ -1,7 +1,7 @@
 
 #include "../include/no_mbc.hh"
 
-u16
+u32
 NoMBC::getCartAddress( u16 address ) {
   return address;
 }
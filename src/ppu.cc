@@ -0,0 +1,280 @@
+#include <chrono>
+
+#include "../include/ppu.hh"
+
+#include "../include/bus.hh"
+#include "../include/cpu.hh"
+#include "../include/ram.hh"
+#include "../include/state.hh"
+
+void
+PPU::initialize( CPU* cpu, RAM* ram, Bus* bus, FrameDump* frameDump ) {
+  this->cpu = cpu;
+  this->ram = ram;
+  this->bus = bus;
+
+  renderer.initialize( frameDump );
+
+  stubLY = conf->GetValue( "Tracer" ) == "GBDoc" || !conf->GetValue( "DoctorLog" ).empty();
+
+  if( conf->GetValue( "PPUThread" ) == "true" ) {
+    threaded = true;
+    frames = std::make_unique< SpscRing< std::vector< WriteEvent > > >( 2 );
+    worker = std::thread( &PPU::run, this );
+  }
+}
+
+PPU::~PPU() {
+  if( threaded ) {
+    done.store( true, std::memory_order_release );
+    worker.join();
+  }
+}
+
+void
+PPU::write( u16 address, u8 data ) {
+  if( threaded ) {
+    writeLog.push_back( { frameClock, address, data } );
+  }
+  else {
+    renderer.write( address, data );
+  }
+}
+
+void
+PPU::setLCDC( u8 data ) {
+  bool enable = ( data & 0x80 ) > 0;
+
+  if( enable == enabled ) {
+    return;
+  }
+
+  enabled = enable;
+  dot = 0;
+
+  if( enabled ) {
+    // The first frame after the LCD is switched on starts at line 0 rather than in VBlank.
+    // Whatever was logged while it was off happened before that line.
+    for( auto& event : writeLog ) {
+      event.when = 0;
+    }
+    frameClock = vblankDots;
+
+    setLY( 0 );
+    setMode( OAMScan );
+  }
+  else {
+    // With the LCD off LY is held at zero and STAT reports HBlank
+    setLY( 0 );
+    setMode( HBlank );
+  }
+}
+
+void
+PPU::_clock() {
+  if( !enabled ) {
+    return;
+  }
+
+  dot++;
+  frameClock++;
+
+  if( ly < Renderer::Height ) {
+    if( dot == oamScanDots ) {
+      setMode( Drawing );
+    }
+    else if( dot == oamScanDots + drawingDots ) {
+      if( !threaded ) {
+        renderer.renderLine( ly );
+      }
+      setMode( HBlank );
+    }
+  }
+
+  if( dot == dotsPerLine ) {
+    dot = 0;
+    setLY( ( ly + 1 ) % linesPerFrame );
+
+    if( ly == Renderer::Height ) {
+      setMode( VBlank );
+      cpu->triggerInterrupt( CPU::Interrupt::VBlank );
+      endFrame();
+    }
+    else if( ly < Renderer::Height ) {
+      setMode( OAMScan );
+    }
+  }
+}
+
+void
+PPU::endFrame() {
+  if( !threaded ) {
+    renderer.finishFrame();
+    return;
+  }
+
+  // Hand the frame's write log to the worker.  If it is still busy with the previous two
+  // frames, wait for it rather than let the log grow without bound.
+  auto slot = frames->reserve();
+  while( slot == nullptr ) {
+    std::this_thread::yield();
+    slot = frames->reserve();
+  }
+
+  slot->swap( writeLog );
+  frames->commit();
+
+  writeLog.clear();
+  frameClock = 0;
+}
+
+void
+PPU::run() {
+  for( ;; ) {
+    auto log = frames->front();
+
+    if( log != nullptr ) {
+      renderFrame( *log );
+      frames->release();
+    }
+    else if( done.load( std::memory_order_acquire ) ) {
+      if( frames->empty() ) {
+        break;
+      }
+    }
+    else {
+      std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+    }
+  }
+}
+
+// Runs on the worker thread.  Each line is drawn at the dot mode 3 ends, after every write
+// that happened before that dot.
+void
+PPU::renderFrame( const std::vector< WriteEvent >& log ) {
+  std::size_t next = 0;
+
+  for( int line = 0; line < Renderer::Height; line++ ) {
+    u32 renderTime = vblankDots + line * dotsPerLine + oamScanDots + drawingDots;
+
+    while( next < log.size() && log[ next ].when < renderTime ) {
+      renderer.write( log[ next ].address, log[ next ].data );
+      next++;
+    }
+
+    renderer.renderLine( line );
+  }
+
+  for( ; next < log.size(); next++ ) {
+    renderer.write( log[ next ].address, log[ next ].data );
+  }
+
+  renderer.finishFrame();
+}
+
+void
+PPU::setMode( Mode newMode ) {
+  // The CPU can't reach OAM while the PPU scans and draws, or VRAM while it draws
+  bool lockOAM = enabled && ( newMode == OAMScan || newMode == Drawing );
+  bool lockVRAM = enabled && newMode == Drawing;
+
+  if( lockOAM != ram->isOAMLocked() ) {
+    ram->lockOAM( lockOAM );
+  }
+  if( lockVRAM != ram->isVRAMLocked() ) {
+    ram->lockVRAM( lockVRAM );
+  }
+
+  mode = newMode;
+  updateStat();
+}
+
+void
+PPU::setLY( u8 line ) {
+  ly = line;
+
+  if( !stubLY ) {
+    ram->write( Bus::IOAddress::LY, ly );
+  }
+
+  updateStat();
+}
+
+void
+PPU::updateStat() {
+  u8 stat = ram->read8( Bus::IOAddress::STAT );
+  bool coincidence = ly == ram->read8( Bus::IOAddress::LYC );
+
+  stat = 0x80 | ( stat & 0x78 ) | ( coincidence ? 0x04 : 0 ) | mode;
+  ram->write( Bus::IOAddress::STAT, stat );
+
+  // The STAT interrupt fires on the rising edge of the OR of all enabled sources
+  bool line = ( coincidence && ( stat & 0x40 ) ) ||
+    ( mode == OAMScan && ( stat & 0x20 ) ) ||
+    ( mode == VBlank && ( stat & 0x10 ) ) ||
+    ( mode == HBlank && ( stat & 0x08 ) );
+
+  if( line && !statLine ) {
+    cpu->triggerInterrupt( CPU::Interrupt::LCD );
+  }
+
+  statLine = line;
+}
+
+void
+PPU::save( StateWriter& state ) {
+  drain();
+
+  state.put( enabled );
+  state.put( dot );
+  state.put( ly );
+  state.put( mode );
+  state.put( statLine );
+  state.put( frameClock );
+  state.put( static_cast< u64 >( writeLog.size() ) );
+  for( auto& event : writeLog ) {
+    state.put( event.when );
+    state.put( event.address );
+    state.put( event.data );
+  }
+  renderer.save( state );
+}
+
+void
+PPU::load( StateReader& state ) {
+  drain();
+
+  state.get( enabled );
+  state.get( dot );
+  state.get( ly );
+  state.get( mode );
+  state.get( statLine );
+  state.get( frameClock );
+  writeLog.resize( state.getCount( sizeof( u32 ) + sizeof( u16 ) + sizeof( u8 ) ) );
+  for( auto& event : writeLog ) {
+    state.get( event.when );
+    state.get( event.address );
+    state.get( event.data );
+  }
+  renderer.load( state );
+}
+
+// Once the worker has caught up the renderer is at the start of the current frame, and
+// writeLog holds the rest
+void
+PPU::setMuted( bool muted ) {
+  // Frames already handed to the worker were drawn before the change
+  drain();
+  renderer.setMuted( muted );
+}
+
+void
+PPU::drain() {
+  if( !threaded ) {
+    return;
+  }
+
+  while( !frames->empty() ) {
+    std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+  }
+}
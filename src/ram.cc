@@ -16,6 +16,7 @@ namespace fs = std::filesystem;
 #include "../include/cpu.hh"
 #include "../include/mbc1.hh"
 #include "../include/no_mbc.hh"
+#include "../include/state.hh"
 
 // Game Boy memory map
 //  $FFFF 	      Interrupt Enable Flag
@@ -35,22 +36,9 @@ namespace fs = std::filesystem;
 // 	$0100-$014F 	Cartridge Header Area
 // 	$0000-$00FF 	Restart and Interrupt Vectors
 
-u16
-correctForEchoRAM( u16 address ) {
-  if( 0xe000 <= address && address <= 0xfdff ) {
-    return address & 0b1101'1111;
-  }
-
-  return address;
-}
-
 void
 logUnusableRAMaccess( std::string method, u16 address ) {
-  char buffer[ 1024 ] = { 0 };
-  sprintf( buffer, "Attempt to %s from unusable RAM address %04x", method.c_str(),
-           address );
-  _log->Write( Log::warn, buffer );
-
+  GBE_LOG( warn, "Attempt to %s from unusable RAM address %04x", method.c_str(), address );
 }
 
 void
@@ -58,45 +46,167 @@ RAM::setBus( Bus* bus ){
   _bus = bus;
 }
 
+// Only pages without a direct mapping get here: cartridge pages the image doesn't cover,
+// OAM and the unusable area.
 u8
-RAM::read8( u16 address ) {
+RAM::slowRead8( u16 address ) {
+  if( address <= maxCartRom ) {
+    if( !mbc ) {
+      return 0xff;
+    }
+
+    auto cartAddress = mbc->getCartAddress( address );
+    if( cartAddress < _cart.size() ) {
+      return _cart[ cartAddress ] & 0xff;
+    }
+    return 0xff;
+  }
+
   if( 0xfea0 <= address && address <= 0xfeff ) {
     logUnusableRAMaccess( "read", address );
   }
+  else if( oamLocked && 0xfe00 <= address && address <= 0xfe9f ) {
+    return 0xff;
+  }
 
-  address = correctForEchoRAM(address);
+  return _ram[ address ] & 0xff;
+}
 
+void
+RAM::slowWrite( u16 address, u8 data ) {
   if( address <= maxCartRom ) {
-    return _cart[ mbc->getCartAddress( address ) ] & 0xff;
+    if( mbc ) {
+      mbc->write( address, data );
+      mapCartBanks();
+    }
+  }
+  else if( 0xfea0 <= address && address <= 0xfeff ) {
+    logUnusableRAMaccess( "write", address );
+  }
+  else if( oamLocked && 0xfe00 <= address && address <= 0xfe9f ) {
+    return;
+  }
+
+  _ram[ address ] = data;
+}
+
+u8
+RAM::peek( u16 address ) {
+  if( address <= maxCartRom ) {
+    return slowRead8( address );
+  }
+
+  // Echo RAM mirrors $C000-$DDFF
+  if( 0xe000 <= address && address <= 0xfdff ) {
+    address -= 0x2000;
   }
 
   return _ram[ address ] & 0xff;
 }
 
 void
-RAM::write( u16 address, u8 data ) {
-  if( 0xfea0 <= address && address <= 0xfeff ) {
-    logUnusableRAMaccess( "write", address );
+RAM::poke( u16 address, u8 data ) {
+  if( 0xe000 <= address && address <= 0xfdff ) {
+    address -= 0x2000;
   }
 
-  if( address <= maxCartRom ) {
-    mbc->write( address, data );
+  _ram[ address ] = data;
+}
+
+void
+RAM::mapPages() {
+  auto ram = reinterpret_cast< u8* >( _ram.data() );
+
+  // Cartridge ROM is read only; writes go to the MBC through the slow path
+  mapCartBanks();
+
+  // VRAM, cartridge RAM, work RAM
+  for( int page = 0x80; page < 0xe0; page++ ) {
+    readPage[ page ] = writePage[ page ] = ram + ( page << 8 );
+  }
+
+  // Echo RAM, $E000-$FDFF mirrors $C000-$DDFF
+  for( int page = 0xe0; page < 0xfe; page++ ) {
+    readPage[ page ] = writePage[ page ] = ram + ( ( page - 0x20 ) << 8 );
   }
 
-  _ram[ correctForEchoRAM( address ) ] = data;
+  // OAM and the unusable area stay on the slow path
+  readPage[ 0xfe ] = writePage[ 0xfe ] = nullptr;
+
+  // IO registers, HRAM and IE.  IO side effects are handled by the Bus before it gets here.
+  readPage[ 0xff ] = writePage[ 0xff ] = ram + 0xff00;
+
+  lockVRAM( vramLocked );
 }
 
 void
-RAM::dbgWrite( u16 address, u8 data ) {
-  // Where to write: cart or ram?
-  if( address <= maxCartRom ) {
-    _cart[ address ] = data;
+RAM::mapCartBanks() {
+  for( int page = 0; page <= ( maxCartRom >> 8 ); page++ ) {
+    readPage[ page ] = nullptr;
+
+    if( mbc ) {
+      auto cartAddress = mbc->getCartAddress( page << 8 );
+      if( cartAddress + 0x100 <= _cart.size() ) {
+        readPage[ page ] = reinterpret_cast< u8* >( _cart.data() ) + cartAddress;
+      }
+    }
   }
-  else {
-    _ram[ address ] = data;
+}
+
+void
+RAM::lockVRAM( bool lock ) {
+  vramLocked = lock;
+
+  for( int page = 0x80; page < 0xa0; page++ ) {
+    if( lock ) {
+      readPage[ page ] = lockedPage;
+      writePage[ page ] = discardPage;
+    }
+    else {
+      readPage[ page ] = writePage[ page ] = reinterpret_cast< u8* >( _ram.data() ) + ( page << 8 );
+    }
   }
 }
 
+void
+RAM::lockOAM( bool lock ) {
+  oamLocked = lock;
+}
+
+void
+RAM::save( StateWriter& state ) const {
+  state.put( _ram.data(), _ram.size() );
+  state.put( bank );
+  state.put( vramLocked );
+  state.put( oamLocked );
+  if( mbc ) {
+    mbc->save( state );
+  }
+}
+
+void
+RAM::load( StateReader& state ) {
+  state.get( _ram.data(), _ram.size() );
+  state.get( bank );
+  state.get( vramLocked );
+  state.get( oamLocked );
+  if( mbc ) {
+    mbc->load( state );
+  }
+
+  mapPages();
+}
+
+u32
+RAM::cartId() const {
+  if( _cart.size() < 0x150 ) {
+    return 0;
+  }
+
+  auto byte = [ this ]( int address ) { return static_cast< u32 >( static_cast< u8 >( _cart[ address ] ) ); };
+  return byte( 0x14d ) << 16 | byte( 0x14e ) << 8 | byte( 0x14f );
+}
+
 dictionary< int, std::string >CartType = {
   { 0x00, "ROM ONLY" },
   { 0x01, "MBC1" },
@@ -153,7 +263,8 @@ RAM::RAM() {
   std::string cartFileName;
 
   try {
-    _ram.reserve( 0xffff );
+    _ram.resize( 0x10000 );
+    std::fill( lockedPage, lockedPage + sizeof( lockedPage ), 0xff );
 
     // TODO: debugging with gameboy doctor, should be removed at some point
     _ram[ 0xff44 ] = 0x90;
@@ -168,7 +279,7 @@ RAM::RAM() {
       fs::path fileName{ cartFileName };
 
       auto fileSize{ fs::file_size( fileName ) };
-      _cart.reserve( fileSize );
+      _cart.resize( fileSize );
 
       std::ifstream inFile{ fileName };
       inFile.read( _cart.data(), fileSize );
@@ -226,15 +337,23 @@ RAM::RAM() {
       sprintf(buffer, "   Global checksum = 0x%02hhx%02hhx", _cart[ 0x14e ], _cart[ 0x14f ] );
       _log->Write( Log::info, buffer );
 
-
     }
-    else {
+    else if( std::find( keys.begin(), keys.end(), "GBS" ) == keys.end() ) {
       _log->Write(Log::error, "No cartridge file to open" );
     }
   }
   catch( std::exception& ) {
     _log->Write( Log::error, "Unable to open cartridge file " + cartFileName );
   }
+
+  mapPages();
+}
+
+void
+RAM::loadImage( std::vector< char > image ) {
+  _cart = std::move( image );
+  mbc = std::make_shared< MBC1 >();
+  mapCartBanks();
 }
 
 std::string
@@ -0,0 +1,266 @@
+#include <algorithm>
+
+#include "../include/renderer.hh"
+
+#include "../include/bus.hh"
+#include "../include/framedump.hh"
+#include "../include/framehash.hh"
+#include "../include/state.hh"
+
+// LCDC bits
+//  7  LCD & PPU enable
+//  6  Window tile map area        0 = 9800-9BFF, 1 = 9C00-9FFF
+//  5  Window enable
+//  4  BG & Window tile data area  0 = 8800-97FF, 1 = 8000-8FFF
+//  3  BG tile map area            0 = 9800-9BFF, 1 = 9C00-9FFF
+//  2  OBJ size                    0 = 8x8, 1 = 8x16
+//  1  OBJ enable
+//  0  BG & Window enable
+
+void
+Renderer::initialize( FrameDump* frameDump ) {
+  this->frameDump = frameDump;
+}
+
+bool
+Renderer::LineStamp::operator==( const LineStamp& other ) const {
+  return registers == other.registers && tileData == other.tileData && oam == other.oam &&
+    bgRow == other.bgRow && windowRow == other.windowRow && windowLine == other.windowLine;
+}
+
+void
+Renderer::setRegister( u8& reg, u8 data ) {
+  if( reg != data ) {
+    reg = data;
+    registerVersion++;
+  }
+}
+
+void
+Renderer::write( u16 address, u8 data ) {
+  if( 0x8000 <= address && address <= 0x9fff ) {
+    u8& cell = vram[ address - 0x8000 ];
+    if( cell == data ) {
+      return;
+    }
+    cell = data;
+
+    if( address < 0x9800 ) {
+      tileDataVersion++;
+    }
+    else {
+      u16 offset = address - 0x9800;
+      mapRowVersion[ offset >> 10 ][ ( offset >> 5 ) & 0x1f ]++;
+    }
+  }
+  else if( 0xfe00 <= address && address <= 0xfe9f ) {
+    u8& cell = oam[ address - 0xfe00 ];
+    if( cell != data ) {
+      cell = data;
+      oamVersion++;
+    }
+  }
+  else {
+    switch( address ) {
+    case Bus::IOAddress::LCDC:
+      setRegister( lcdc, data );
+      break;
+    case Bus::IOAddress::SCY:
+      setRegister( scy, data );
+      break;
+    case Bus::IOAddress::SCX:
+      setRegister( scx, data );
+      break;
+    case Bus::IOAddress::WY:
+      setRegister( wy, data );
+      break;
+    case Bus::IOAddress::WX:
+      setRegister( wx, data );
+      break;
+    case Bus::IOAddress::BGP:
+      setRegister( bgp, data );
+      break;
+    case Bus::IOAddress::OBP0:
+      setRegister( obp[ 0 ], data );
+      break;
+    case Bus::IOAddress::OBP1:
+      setRegister( obp[ 1 ], data );
+      break;
+    }
+  }
+}
+
+int
+Renderer::tileRow( u16 mapBase, u8 x, u8 y ) {
+  u8 tile = vram8( mapBase + ( y / 8 ) * 32 + x / 8 );
+  u16 addr;
+  if( lcdc & 0x10 ) {
+    addr = 0x8000 + tile * 16;
+  }
+  else {
+    addr = 0x9000 + static_cast< i8 >( tile ) * 16;
+  }
+  addr += ( y % 8 ) * 2;
+  return ( vram8( addr + 1 ) << 8 ) | vram8( addr );
+}
+
+static inline int
+pixel( int row, int bit ) {
+  return ( ( ( row >> ( 8 + bit ) ) & 1 ) << 1 ) | ( ( row >> bit ) & 1 );
+}
+
+void
+Renderer::renderLine( int line ) {
+  if( line == 0 ) {
+    windowLine = 0;
+    frameHash = 0;
+  }
+
+  bool windowVisible = ( lcdc & 0x21 ) == 0x21 && line >= wy && wx <= 166;
+
+  // The versions of everything this line reads.  The tile map rows are the ones selected by
+  // the scroll registers, which are covered by the register version.
+  LineStamp stamp{ registerVersion, tileDataVersion,
+                   ( lcdc & 0x02 ) ? oamVersion : 0,
+                   mapRowVersion[ ( lcdc >> 3 ) & 1 ][ ( ( line + scy ) & 0xff ) / 8 ],
+                   windowVisible ? mapRowVersion[ ( lcdc >> 6 ) & 1 ][ ( windowLine / 8 ) & 0x1f ] : 0,
+                   windowVisible ? windowLine : -1 };
+
+  if( lineStamps[ line ] == stamp ) {
+    // Nothing the line depends on has changed since the last frame drew it
+    if( windowVisible ) {
+      windowLine++;
+    }
+    frameHash = hashCombine( frameHash, lineHashes[ line ] );
+    return;
+  }
+
+  u8* out = frame.data() + line * Width;
+  u8 colorIndex[ Width ] = { 0 };  // BG/window color before the palette, for OBJ priority
+
+  if( lcdc & 0x01 ) {
+    u16 bgMap = ( lcdc & 0x08 ) ? 0x9c00 : 0x9800;
+    u8 y = line + scy;
+
+    for( int x = 0; x < Width; x++ ) {
+      u8 bx = x + scx;
+      colorIndex[ x ] = pixel( tileRow( bgMap, bx, y ), 7 - ( bx % 8 ) );
+    }
+
+    if( windowVisible ) {
+      u16 windowMap = ( lcdc & 0x40 ) ? 0x9c00 : 0x9800;
+
+      for( int x = std::max( 0, wx - 7 ); x < Width; x++ ) {
+        u8 wxPos = x - ( wx - 7 );
+        colorIndex[ x ] = pixel( tileRow( windowMap, wxPos, windowLine ), 7 - ( wxPos % 8 ) );
+      }
+
+      windowLine++;
+    }
+  }
+
+  for( int x = 0; x < Width; x++ ) {
+    out[ x ] = ( bgp >> ( colorIndex[ x ] * 2 ) ) & 0x3;
+  }
+
+  if( lcdc & 0x02 ) {
+    int height = ( lcdc & 0x04 ) ? 16 : 8;
+    int selected[ 10 ];
+    int count = 0;
+
+    // OAM scan picks the first ten objects that overlap this line
+    for( int i = 0; i < 40 && count < 10; i++ ) {
+      int top = oam[ i * 4 ] - 16;
+      if( top <= line && line < top + height ) {
+        selected[ count++ ] = i;
+      }
+    }
+
+    // Draw in reverse priority so objects with a smaller X (then lower OAM index) win
+    std::stable_sort( selected, selected + count, [ & ]( int a, int b ) {
+      return oam[ a * 4 + 1 ] < oam[ b * 4 + 1 ];
+    });
+
+    for( int s = count - 1; s >= 0; s-- ) {
+      const u8* entry = oam + selected[ s ] * 4;
+      int top = entry[ 0 ] - 16;
+      int left = entry[ 1 ] - 8;
+      u8 tile = entry[ 2 ];
+      u8 attrs = entry[ 3 ];
+
+      int row = line - top;
+      if( attrs & 0x40 ) {
+        row = height - 1 - row;
+      }
+      if( height == 16 ) {
+        tile &= 0xfe;
+      }
+
+      u16 addr = 0x8000 + tile * 16 + row * 2;
+      int data = ( vram8( addr + 1 ) << 8 ) | vram8( addr );
+
+      for( int px = 0; px < 8; px++ ) {
+        int x = left + px;
+        if( x < 0 || Width <= x ) {
+          continue;
+        }
+
+        int color = pixel( data, ( attrs & 0x20 ) ? px : 7 - px );
+        if( color == 0 ) {
+          continue;
+        }
+        if( ( attrs & 0x80 ) && colorIndex[ x ] != 0 ) {
+          continue;
+        }
+
+        out[ x ] = ( obp[ ( attrs >> 4 ) & 1 ] >> ( color * 2 ) ) & 0x3;
+      }
+    }
+  }
+
+  lineStamps[ line ] = stamp;
+  lineHashes[ line ] = hashLine( out, Width );
+  frameHash = hashCombine( frameHash, lineHashes[ line ] );
+}
+
+void
+Renderer::finishFrame() {
+  bool duplicate = frameNumber > 0 && frameHash == lastFrameHash;
+  if( !muted ) {
+    frameDump->submit( frame, frameNumber++, frameHash, duplicate );
+  }
+  lastFrameHash = frameHash;
+}
+
+void
+Renderer::save( StateWriter& state ) const {
+  state.put( vram );
+  state.put( oam );
+  state.put( lcdc );
+  state.put( scy );
+  state.put( scx );
+  state.put( wy );
+  state.put( wx );
+  state.put( bgp );
+  state.put( obp );
+  state.put( windowLine );
+  state.put( frame );
+}
+
+void
+Renderer::load( StateReader& state ) {
+  state.get( vram );
+  state.get( oam );
+  state.get( lcdc );
+  state.get( scy );
+  state.get( scx );
+  state.get( wy );
+  state.get( wx );
+  state.get( bgp );
+  state.get( obp );
+  state.get( windowLine );
+  state.get( frame );
+
+  // None of the lines drawn so far can be trusted to match
+  std::fill( std::begin( lineStamps ), std::end( lineStamps ), LineStamp{} );
+}
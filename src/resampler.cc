@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+#if defined( __SSE__ )
+#include <xmmintrin.h>
+#endif
+
+#include "../include/resampler.hh"
+
+Resampler::Resampler( int inRate, int outRate ) {
+  int divisor = std::gcd( inRate, outRate );
+  L = outRate / divisor;
+  M = inRate / divisor;
+
+  // Blackman windowed sinc with its cut off just below the lower of the two Nyquist
+  // frequencies, in cycles per input sample
+  const double pi = 3.14159265358979323846;
+  const double cutoff = 0.45 * std::min( inRate, outRate ) / inRate;
+  const double half = taps / 2;
+
+  table.resize( static_cast< std::size_t >( L ) * taps );
+
+  for( int p = 0; p < L; p++ ) {
+    float* row = table.data() + static_cast< std::size_t >( p ) * taps;
+    double sum = 0;
+
+    for( int k = 0; k < taps; k++ ) {
+      // Distance from the output sample to input sample k of the window
+      double d = k - ( half - 1 ) - static_cast< double >( p ) / L;
+      double sinc = d == 0 ? 1.0 : std::sin( 2 * pi * cutoff * d ) / ( 2 * pi * cutoff * d );
+      double window = 0.42 + 0.5 * std::cos( pi * d / half ) + 0.08 * std::cos( 2 * pi * d / half );
+      row[ k ] = sinc * window;
+      sum += row[ k ];
+    }
+
+    // Unity gain at DC for every phase
+    for( int k = 0; k < taps; k++ ) {
+      row[ k ] /= sum;
+    }
+  }
+
+  pending.assign( taps - 1, 0.0f );
+}
+
+void
+Resampler::process( const float* in, std::size_t count, std::vector< float >& out, bool reference ) {
+  pending.insert( pending.end(), in, in + count );
+
+  std::size_t position = 0;
+  while( position + taps <= pending.size() ) {
+    const float* h = table.data() + static_cast< std::size_t >( phase ) * taps;
+    const float* x = pending.data() + position;
+
+    out.push_back( reference ? dotReference( x, h ) : dot( x, h ) );
+
+    phase += M;
+    position += phase / L;
+    phase %= L;
+  }
+
+  pending.erase( pending.begin(), pending.begin() + std::min( position, pending.size() ) );
+}
+
+// Four running sums, one per SIMD lane, combined as ( s0 + s2 ) + ( s1 + s3 ).  The SIMD
+// version below does the same multiplies and adds in the same order.
+float
+Resampler::dotReference( const float* x, const float* h ) {
+  float sums[ 4 ] = { 0, 0, 0, 0 };
+
+  for( int k = 0; k < taps; k++ ) {
+    sums[ k & 3 ] += x[ k ] * h[ k ];
+  }
+
+  return ( sums[ 0 ] + sums[ 2 ] ) + ( sums[ 1 ] + sums[ 3 ] );
+}
+
+float
+Resampler::dot( const float* x, const float* h ) {
+#if defined( __SSE__ )
+  __m128 sums = _mm_setzero_ps();
+
+  for( int k = 0; k < taps; k += 4 ) {
+    sums = _mm_add_ps( sums, _mm_mul_ps( _mm_loadu_ps( x + k ), _mm_loadu_ps( h + k ) ) );
+  }
+
+  // ( s0 + s2, s1 + s3 ), then the two halves
+  sums = _mm_add_ps( sums, _mm_movehl_ps( sums, sums ) );
+  sums = _mm_add_ss( sums, _mm_shuffle_ps( sums, sums, 1 ) );
+  return _mm_cvtss_f32( sums );
+#else
+  return dotReference( x, h );
+#endif
+}
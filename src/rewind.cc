@@ -0,0 +1,110 @@
+#include <iostream>
+#include <string>
+
+#include "../include/rewind.hh"
+
+#include "../include/board.hh"
+
+Rewind::Rewind() {
+  interval = conf->GetNumber( "Rewind", interval );
+  budget = conf->GetNumber( "RewindBudget", budget >> 20 ) << 20;
+
+  next = isEnabled() ? 0 : UINT64_MAX;
+}
+
+void
+Rewind::initialize( Board* board ) {
+  this->board = board;
+}
+
+void
+Rewind::snapshot() {
+  auto& cpu = board->getCpu();
+  if( !cpu.atInstructionBoundary() ) {
+    return;
+  }
+
+  // Make room, keeping the newest
+  while( !snapshots.empty() && used > budget ) {
+    used -= snapshots.front().state.size();
+    spare.swap( snapshots.front().state );
+    snapshots.pop_front();
+  }
+
+  snapshots.push_back( { cpu.ticks, {} } );
+  auto& state = snapshots.back().state;
+  state.swap( spare );
+  board->save( state );
+  used += state.size();
+
+  next = cpu.ticks + interval;
+}
+
+bool
+Rewind::canReverse() const {
+  auto current = board->getCpu().ticks;
+
+  // A snapshot taken just before this fetch has nothing between it and here
+  return !snapshots.empty() && snapshots.front().tick + 1 < current;
+}
+
+void
+Rewind::reverse( Kind kind ) {
+  auto& cpu = board->getCpu();
+  auto current = cpu.ticks;
+
+  // Search back one snapshot at a time for the last fetch, or breakpoint hit, before limit
+  std::vector< u64 > found;
+  u64 limit = current;
+  std::size_t index = snapshots.size();
+  u64 target = 0;
+
+  while( index-- > 0 ) {
+    if( snapshots[ index ].tick + 1 < limit ) {
+      found.clear();
+      runFrom( index, limit - 1, &found, kind == step );
+      if( !found.empty() ) {
+        target = found.back();
+        break;
+      }
+    }
+    limit = snapshots[ index ].tick + 1;
+  }
+
+  if( index == SIZE_MAX ) {
+    // Nothing earlier: go to the start of the oldest snapshot
+    index = 0;
+    target = snapshots[ 0 ].tick + 1;
+    std::cout << ( kind == step ? "Reached the oldest snapshot" : "No breakpoint hit since the oldest snapshot" )
+              << std::endl;
+  }
+
+  // The next _clock fetches the target instruction
+  runFrom( index, target - 1, nullptr, false );
+
+  while( snapshots.size() > index + 1 ) {
+    used -= snapshots.back().state.size();
+    snapshots.pop_back();
+  }
+  next = snapshots.back().tick + interval;
+
+  std::cout << "Went back " << std::dec << current - target << " ticks" << std::endl;
+  cpu.stopAtNextInstruction();
+}
+
+void
+Rewind::runFrom( std::size_t index, u64 until, std::vector< u64 >* log, bool everyFetch ) {
+  auto& cpu = board->getCpu();
+
+  board->load( snapshots[ index ].state );
+
+  // No snapshots while replaying, and no debugger stops
+  next = UINT64_MAX;
+  board->setReplaying( true );
+  cpu.beginReplay( log, everyFetch );
+  while( cpu.ticks < until ) {
+    board->_clock();
+  }
+  cpu.endReplay();
+  board->setReplaying( false );
+}
@@ -6,28 +6,191 @@
 #include "../include/serial.hh"
 
 #include "../include/bus.hh"
+#include "../include/cpu.hh"
+#include "../include/ram.hh"
+#include "../include/socketlink.hh"
+#include "../include/state.hh"
 
 Serial::Serial() {
   auto keys = conf->GetKeys();
   auto hasSerialLog = std::find( keys.begin(), keys.end(), "SerialLog" );
 
   if( hasSerialLog != keys.end() ) {
-    os.open( *hasSerialLog, std::ios::app );
+    os.open( conf->GetValue( *hasSerialLog ), std::ios::app );
   }
+
+  window = std::clamp< u64 >( conf->GetNumber( "LinkWindow", window ), 1, maxWindow );
+
+  auto hasLinkSocket = std::find( keys.begin(), keys.end(), "LinkSocket" );
+  if( hasLinkSocket != keys.end() ) {
+    auto mode = conf->GetValue( "LinkMode" ) == "listen" ? SocketLink::listen : SocketLink::connect;
+
+    try {
+      socketLink = std::make_unique< SocketLink >( conf->GetValue( *hasLinkSocket ), mode, window );
+      link = socketLink.get();
+    }
+    catch( std::runtime_error& ex ) {
+      _log->Write( Log::error, ex.what() );
+    }
+  }
+
+  if( link ) {
+    windowEnd = window;
+  }
+  budgetEnd = oracle.budget();
+  schedule();
 }
 
 void
-Serial::initialize( Bus *bus ) {
+Serial::initialize( CPU* cpu, RAM* ram, Bus *bus ) {
+  this->cpu = cpu;
+  this->ram = ram;
   this->bus = bus;
 }
 
+void
+Serial::setLink( LinkPort* port, u32 window ) {
+  link = port;
+  this->window = std::clamp< u32 >( window, 1, maxWindow );
+  windowEnd = ( cpu->ticks / this->window + 1 ) * this->window;
+  pending = LinkMessage{};
+  schedule();
+}
+
 void
 Serial::write() {
-  if( os.is_open() ) {
-    auto control = (bus->read(Bus::IOAddress::SC)) & 0xff;
-    if ((control & 0x81) == 0x81) {
-      u8 data = (bus->read(Bus::IOAddress::SB)) & 0xff;
+  auto control = ( bus->read( Bus::IOAddress::SC ) ) & 0xff;
+  u8 data = ( bus->read( Bus::IOAddress::SB ) ) & 0xff;
+
+  if( ( control & 0x81 ) == 0x81 && !muted ) {
+    if( os.is_open() ) {
       os << static_cast<char>(data);
     }
+    oracle.feed( data );
+  }
+
+  if( ( control & 0x80 ) == 0 ) {
+    // Transfer cancelled
+    transferring = false;
+    transferEnd = UINT64_MAX;
+    pending.started = false;
+  }
+  else if( control & 0x01 ) {
+    // Internal clock: this side drives the transfer.  What comes back is only known once
+    // the peer has answered at the end of the window.
+    u64 now = cpu->ticks;
+    transferring = true;
+    transferEnd = now + byteCycles;
+    incoming = 0xff;
+
+    if( link ) {
+      pending.started = true;
+      pending.startOffset = now - ( windowEnd - window );
+      pending.data = data;
+    }
+  }
+  // On the external clock nothing happens until the peer starts a transfer
+
+  schedule();
+}
+
+void
+Serial::event( u64 ticks ) {
+  // A transfer can end on the same cycle as a window; finish it first so the next window
+  // reports the new SB
+  while( ticks >= nextEvent ) {
+    if( ticks >= budgetEnd ) {
+      oracle.timeOut();
+      budgetEnd = UINT64_MAX;
+    }
+    else if( ticks >= transferEnd ) {
+      complete();
+    }
+    else {
+      sync();
+    }
+    schedule();
   }
 }
+
+// End of a lockstep window: swap messages with the peer
+void
+Serial::sync() {
+  u8 control = ram->read8( Bus::IOAddress::SC );
+
+  LinkMessage out = pending;
+  LinkMessage in;
+  out.sb = ram->read8( Bus::IOAddress::SB );
+  out.armed = ( control & 0x81 ) == 0x80 && !transferring;
+
+  u64 windowStart = windowEnd - window;
+
+  if( !link->exchange( out, in ) ) {
+    link = nullptr;
+    socketLink.reset();
+    windowEnd = UINT64_MAX;
+    pending = LinkMessage{};
+    return;
+  }
+
+  if( out.started ) {
+    // The peer's shift register is what comes back.  It is reported as of the end of the
+    // window; a program can't change SB once it has armed a transfer without spoiling it.
+    incoming = in.sb;
+  }
+
+  if( in.started && out.armed ) {
+    // The peer clocked a byte at us; it ends on the same cycle on both sides
+    transferring = true;
+    transferEnd = windowStart + in.startOffset + byteCycles;
+    incoming = in.data;
+  }
+
+  pending = LinkMessage{};
+  windowEnd += window;
+}
+
+void
+Serial::complete() {
+  ram->write( Bus::IOAddress::SB, incoming );
+  ram->write( Bus::IOAddress::SC, ram->read8( Bus::IOAddress::SC ) & 0x7f );
+  cpu->triggerInterrupt( CPU::Interrupt::Serial );
+
+  transferring = false;
+  transferEnd = UINT64_MAX;
+}
+
+void
+Serial::schedule() {
+  nextEvent = std::min( { windowEnd, transferEnd, budgetEnd } );
+}
+
+void
+Serial::save( StateWriter& state ) const {
+  state.put( windowEnd );
+  state.put( transferring );
+  state.put( transferEnd );
+  state.put( incoming );
+  state.put( pending.sb );
+  state.put( pending.armed );
+  state.put( pending.started );
+  state.put( pending.startOffset );
+  state.put( pending.data );
+  state.put( budgetEnd );
+  state.put( nextEvent );
+}
+
+void
+Serial::load( StateReader& state ) {
+  state.get( windowEnd );
+  state.get( transferring );
+  state.get( transferEnd );
+  state.get( incoming );
+  state.get( pending.sb );
+  state.get( pending.armed );
+  state.get( pending.started );
+  state.get( pending.startOffset );
+  state.get( pending.data );
+  state.get( budgetEnd );
+  state.get( nextEvent );
+}
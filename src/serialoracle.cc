@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <sstream>
+
+#include "../include/serialoracle.hh"
+
+SerialOracle::SerialOracle() {
+  auto keys = conf->GetKeys();
+
+  auto budgetValue = conf->GetValue( "CycleBudget" );
+  if( !budgetValue.empty() ) {
+    cycleBudget = conf->GetNumber( "CycleBudget", 0 );
+    enabled = true;
+  }
+
+  if( conf->GetValue( "SerialOracle" ) != "true" ) {
+    return;
+  }
+  enabled = true;
+
+  auto hasPass = std::find( keys.begin(), keys.end(), "SerialPass" );
+  addPatterns( hasPass != keys.end() ? conf->GetValue( *hasPass ) : "Passed", passed );
+
+  auto hasFail = std::find( keys.begin(), keys.end(), "SerialFail" );
+  addPatterns( hasFail != keys.end() ? conf->GetValue( *hasFail ) : "Failed", failed );
+}
+
+void
+SerialOracle::addPatterns( const std::string& list, Verdict verdict ) {
+  std::stringstream ss{ list };
+  std::string text;
+
+  while( std::getline( ss, text, '|' ) ) {
+    if( text.empty() ) {
+      continue;
+    }
+
+    Pattern pattern;
+    pattern.text = text;
+    pattern.verdict = verdict;
+
+    // fallback[ i ] is the length of the longest proper prefix of text[ 0 .. i ] that is
+    // also a suffix of it
+    pattern.fallback.assign( text.size(), 0 );
+    for( std::size_t i = 1, k = 0; i < text.size(); i++ ) {
+      while( k > 0 && text[ i ] != text[ k ] ) {
+        k = pattern.fallback[ k - 1 ];
+      }
+      if( text[ i ] == text[ k ] ) {
+        k++;
+      }
+      pattern.fallback[ i ] = k;
+    }
+
+    patterns.push_back( pattern );
+  }
+}
+
+void
+SerialOracle::feed( u8 data ) {
+  char c = static_cast< char >( data );
+  ring[ received++ % ringSize ] = c;
+
+  if( result != running ) {
+    return;
+  }
+
+  for( auto& p : patterns ) {
+    while( p.matched > 0 && p.text[ p.matched ] != c ) {
+      p.matched = p.fallback[ p.matched - 1 ];
+    }
+    if( p.text[ p.matched ] == c ) {
+      p.matched++;
+    }
+
+    if( p.matched == static_cast< int >( p.text.size() ) ) {
+      result = p.verdict;
+      return;
+    }
+  }
+}
+
+void
+SerialOracle::timeOut() {
+  if( result == running ) {
+    result = timedOut;
+  }
+}
+
+std::string
+SerialOracle::tail() const {
+  std::string text;
+  u64 count = std::min< u64 >( received, ringSize );
+
+  for( u64 i = received - count; i < received; i++ ) {
+    text += ring[ i % ringSize ];
+  }
+
+  return text;
+}
+
+int
+SerialOracle::exitStatus() const {
+  switch( result ) {
+  case passed:
+    return 0;
+  case failed:
+    return 1;
+  default:
+    return 2;
+  }
+}
+
+const char*
+SerialOracle::name( Verdict verdict ) {
+  switch( verdict ) {
+  case passed:
+    return "passed";
+  case failed:
+    return "failed";
+  case timedOut:
+    return "timed out";
+  default:
+    return "running";
+  }
+}
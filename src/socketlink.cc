@@ -0,0 +1,175 @@
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../include/socketlink.hh"
+
+static const int messageSize = 8;
+static const int handshakeSize = 4;
+
+// How long to wait for the other emulator to show up, and for it to answer a window
+static const int connectSeconds = 30;
+static const int receiveSeconds = 10;
+
+static void
+fillAddress( sockaddr_un& address, const std::string& path ) {
+  if( path.size() >= sizeof( address.sun_path ) ) {
+    throw std::runtime_error( "Link socket path " + path + " is too long" );
+  }
+
+  std::memset( &address, 0, sizeof( address ) );
+  address.sun_family = AF_UNIX;
+  std::strcpy( address.sun_path, path.c_str() );
+}
+
+// Returns what the last recv returned: size, or 0 / -1 if the peer is gone
+static ssize_t
+receiveAll( int fd, u8* buffer, int size ) {
+  int received = 0;
+  while( received < size ) {
+    auto count = recv( fd, buffer + received, size - received, 0 );
+    if( count <= 0 ) {
+      return count;
+    }
+    received += count;
+  }
+  return received;
+}
+
+SocketLink::SocketLink( const std::string& path, Mode mode, u32 window )
+  : path( path ), mode( mode ) {
+  sockaddr_un address;
+  fillAddress( address, path );
+
+  int s = socket( AF_UNIX, SOCK_STREAM, 0 );
+  if( s < 0 ) {
+    throw std::runtime_error( std::string( "Unable to create link socket: " ) + strerror( errno ) );
+  }
+
+  if( mode == listen ) {
+    unlink( path.c_str() );
+    if( bind( s, reinterpret_cast< sockaddr* >( &address ), sizeof( address ) ) < 0 ||
+        ::listen( s, 1 ) < 0 ) {
+      close( s );
+      throw std::runtime_error( "Unable to listen on link socket " + path + ": " + strerror( errno ) );
+    }
+
+    _log->Write( Log::info, "Waiting for the link cable peer on " + path );
+    fd = accept( s, nullptr, nullptr );
+    close( s );
+
+    if( fd < 0 ) {
+      throw std::runtime_error( "Link socket accept failed: " + std::string( strerror( errno ) ) );
+    }
+  }
+  else {
+    // The listening side may not be up yet
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds( connectSeconds );
+    while( ::connect( s, reinterpret_cast< sockaddr* >( &address ), sizeof( address ) ) < 0 ) {
+      if( std::chrono::steady_clock::now() > deadline ) {
+        close( s );
+        throw std::runtime_error( "Unable to connect to link socket " + path + ": " + strerror( errno ) );
+      }
+      std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+    }
+    fd = s;
+  }
+
+  timeval timeout = { receiveSeconds, 0 };
+  setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof( timeout ) );
+
+  try {
+    handshake( window );
+  }
+  catch( std::runtime_error& ) {
+    close( fd );
+    if( mode == listen ) {
+      unlink( path.c_str() );
+    }
+    throw;
+  }
+
+  _log->Write( Log::info, "Link cable connected on " + path );
+}
+
+SocketLink::~SocketLink() {
+  if( fd >= 0 ) {
+    close( fd );
+  }
+  if( mode == listen ) {
+    unlink( path.c_str() );
+  }
+}
+
+// Both sides must sync on the same cycles, or transfers would end at different times
+void
+SocketLink::handshake( u32 window ) {
+  u8 buffer[ handshakeSize ] = {
+    static_cast< u8 >( window & 0xff ),
+    static_cast< u8 >( ( window >> 8 ) & 0xff ),
+    static_cast< u8 >( ( window >> 16 ) & 0xff ),
+    static_cast< u8 >( ( window >> 24 ) & 0xff ),
+  };
+
+  if( send( fd, buffer, handshakeSize, MSG_NOSIGNAL ) != handshakeSize ||
+      receiveAll( fd, buffer, handshakeSize ) != handshakeSize ) {
+    throw std::runtime_error( "Link cable peer on " + path + " went away during the handshake" );
+  }
+
+  u32 theirs = buffer[ 0 ] | ( buffer[ 1 ] << 8 ) | ( buffer[ 2 ] << 16 ) |
+               ( static_cast< u32 >( buffer[ 3 ] ) << 24 );
+  if( theirs != window ) {
+    throw std::runtime_error( "Link cable peer on " + path + " uses LinkWindow=" +
+                              std::to_string( theirs ) + ", this side " + std::to_string( window ) );
+  }
+}
+
+bool
+SocketLink::exchange( const LinkMessage& out, LinkMessage& in ) {
+  if( fd < 0 ) {
+    return false;
+  }
+
+  u8 buffer[ messageSize ] = {
+    out.sb,
+    static_cast< u8 >( ( out.armed ? 1 : 0 ) | ( out.started ? 2 : 0 ) ),
+    out.data,
+    0,
+    static_cast< u8 >( out.startOffset & 0xff ),
+    static_cast< u8 >( ( out.startOffset >> 8 ) & 0xff ),
+    static_cast< u8 >( ( out.startOffset >> 16 ) & 0xff ),
+    static_cast< u8 >( ( out.startOffset >> 24 ) & 0xff ),
+  };
+
+  if( send( fd, buffer, messageSize, MSG_NOSIGNAL ) != messageSize ) {
+    _log->Write( Log::warn, "Link cable peer went away while sending" );
+    close( fd );
+    fd = -1;
+    return false;
+  }
+
+  auto count = receiveAll( fd, buffer, messageSize );
+  if( count <= 0 ) {
+    _log->Write( Log::warn, count == 0 ? "Link cable peer disconnected"
+                                       : "Link cable peer stopped answering" );
+    close( fd );
+    fd = -1;
+    return false;
+  }
+
+  in.sb = buffer[ 0 ];
+  in.armed = ( buffer[ 1 ] & 1 ) > 0;
+  in.started = ( buffer[ 1 ] & 2 ) > 0;
+  in.data = buffer[ 2 ];
+  in.startOffset = buffer[ 4 ] | ( buffer[ 5 ] << 8 ) | ( buffer[ 6 ] << 16 ) |
+                   ( static_cast< u32 >( buffer[ 7 ] ) << 24 );
+
+  return true;
+}
@@ -3,6 +3,7 @@
 #include "../include/cpu.hh"
 #include "../include/ram.hh"
 #include "../include/bus.hh"
+#include "../include/state.hh"
 
 void
 Timer::initialize( CPU* cpu, RAM* ram, Bus* bus ) {
@@ -54,3 +55,19 @@ Timer::setTAC( u8 data ) {
 
   timerIncrement = increments[ ( data & clockSelectMask ) ];
 }
+
+void
+Timer::save( StateWriter& state ) const {
+  state.put( t_ticks );
+  state.put( m_ticks );
+  state.put( enabled );
+  state.put( timerIncrement );
+}
+
+void
+Timer::load( StateReader& state ) {
+  state.get( t_ticks );
+  state.get( m_ticks );
+  state.get( enabled );
+  state.get( timerIncrement );
+}
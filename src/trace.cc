@@ -0,0 +1,347 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../include/trace.hh"
+
+#include "../include/tracecodec.hh"
+
+static const char traceMagic[ 8 ] = { 'G', 'B', 'E', 'T', 'R', 'A', 'C', 'E' };
+
+TraceFile::TraceFile( const std::string& fileName, TraceHeader::Encoding encoding, u32 flags )
+  : fileName( fileName ) {
+  fd = open( fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644 );
+  if( fd < 0 ) {
+    throw std::runtime_error( "Unable to open trace " + fileName + ": " + strerror( errno ) );
+  }
+
+  grow();
+
+  TraceHeader head;
+  std::memcpy( head.magic, traceMagic, sizeof( head.magic ) );
+  head.version = encoding;
+  head.recordSize = sizeof( TraceRecord );
+  head.flags = flags;
+
+  std::memcpy( base, &head, sizeof( head ) );
+  used = sizeof( head );
+}
+
+TraceFile::~TraceFile() {
+  if( base != nullptr ) {
+    munmap( base, mapped );
+  }
+
+  if( fd >= 0 ) {
+    if( ftruncate( fd, used ) < 0 ) {
+      _log->Write( Log::error, "Unable to trim trace " + fileName + ": " + strerror( errno ) );
+    }
+    close( fd );
+  }
+
+  char buffer[ 1024 ];
+  sprintf( buffer, "Trace %s: %lu bytes", fileName.c_str(), used );
+  _log->Write( Log::info, buffer );
+}
+
+void
+TraceFile::skip( std::size_t size ) {
+  if( used + size > mapped ) {
+    grow();
+  }
+  used += size;
+}
+
+void
+TraceFile::grow() {
+  if( base != nullptr ) {
+    munmap( base, mapped );
+    base = nullptr;
+  }
+
+  std::size_t size = mapped + chunkSize;
+  if( ftruncate( fd, size ) < 0 ) {
+    throw std::runtime_error( "Unable to extend trace " + fileName + ": " + strerror( errno ) );
+  }
+
+  void* p = mmap( nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+  if( p == MAP_FAILED ) {
+    throw std::runtime_error( "Unable to map trace " + fileName + ": " + strerror( errno ) );
+  }
+
+  base = static_cast< char* >( p );
+  mapped = size;
+}
+
+TraceWriter::TraceWriter( const std::string& fileName, TraceHeader::Encoding encoding, u32 flags,
+                          const TraceOpcodes& opcodes )
+  : file( fileName, encoding, flags ) {
+  if( encoding == TraceHeader::delta ) {
+    codec = std::make_unique< TraceCodec >( opcodes );
+  }
+
+  auto policyValue = conf->GetValue( "TracePolicy" );
+  if( policyValue == "drop" ) {
+    policy = drop;
+  }
+  else if( policyValue == "sample" ) {
+    policy = sample;
+  }
+  else if( !policyValue.empty() && policyValue != "block" ) {
+    _log->Write( Log::warn, "Unknown TracePolicy " + policyValue + ", using block" );
+  }
+
+  sampleRate = std::max< u64 >( conf->GetNumber( "TraceSample", sampleRate ), 1 );
+
+  worker = std::thread( &TraceWriter::run, this );
+}
+
+TraceWriter::~TraceWriter() {
+  done.store( true, std::memory_order_release );
+  worker.join();
+
+  char buffer[ 1024 ] = { 0 };
+  sprintf( buffer, "Trace writer: %lu records submitted, %lu dropped, %lu sampled out, %lu waited for the writer",
+           submitted, dropped, sampledOut, stalls );
+  _log->Write( dropped + sampledOut > 0 ? Log::warn : Log::info, buffer );
+}
+
+void
+TraceWriter::submitSlow( const TraceRecord& record ) {
+  if( thinning ) {
+    if( queue.size() <= queue.capacity() / 2 ) {
+      thinning = false;
+    }
+    else if( ++sampleCount % sampleRate != 0 ) {
+      sampledOut++;
+      lost = true;
+      return;
+    }
+  }
+
+  TraceRecord copy = record;
+  if( lost ) {
+    copy.flags |= TraceRecord::afterGap;
+  }
+
+  if( queue.tryPush( copy ) ) {
+    lost = false;
+    return;
+  }
+
+  switch( policy ) {
+  case block:
+    stalls++;
+    do {
+      std::this_thread::yield();
+    } while( !queue.tryPush( copy ) );
+    lost = false;
+    break;
+
+  case drop:
+    dropped++;
+    lost = true;
+    break;
+
+  case sample:
+    dropped++;
+    lost = true;
+    thinning = true;
+    sampleCount = 0;
+    break;
+  }
+}
+
+void
+TraceWriter::run() {
+  for( ;; ) {
+    auto record = queue.front();
+
+    if( record != nullptr ) {
+      encode( *record );
+      queue.release();
+    }
+    else if( done.load( std::memory_order_acquire ) ) {
+      // The producer has stopped; one more look at the queue drains anything left
+      if( queue.empty() ) {
+        break;
+      }
+    }
+    else {
+      std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+    }
+  }
+}
+
+void
+TraceWriter::encode( const TraceRecord& record ) {
+  if( !codec ) {
+    file.append( &record, sizeof( record ) );
+    return;
+  }
+
+  if( blockStart == 0 || file.size() + TraceCodec::maxEncodedSize > blockStart + TraceCodec::blockSize ) {
+    // Blocks sit at fixed offsets so a reader can find them without an index
+    if( blockStart != 0 ) {
+      file.skip( blockStart + TraceCodec::blockSize - file.size() );
+    }
+    blockStart = file.size();
+
+    u32 blockUsed = TraceCodec::blockHeaderSize;
+    file.append( &blockUsed, sizeof( blockUsed ) );
+    file.append( &record, sizeof( record ) );
+    codec->reset( record );
+    return;
+  }
+
+  u8 buffer[ TraceCodec::maxEncodedSize ];
+  file.append( buffer, codec->encode( record, buffer ) );
+
+  // Kept current so a trace from a process that died is readable up to its last record
+  u32 blockUsed = file.size() - blockStart;
+  std::memcpy( file.at( blockStart ), &blockUsed, sizeof( blockUsed ) );
+}
+
+TraceReader::TraceReader( const std::string& fileName, const TraceOpcodes& opcodes )
+  : is( fileName, std::ios::binary ) {
+  if( !is ) {
+    throw std::runtime_error( "Unable to open trace " + fileName );
+  }
+
+  if( !is.read( reinterpret_cast< char* >( &head ), sizeof( head ) ) ||
+      std::memcmp( head.magic, traceMagic, sizeof( head.magic ) ) != 0 ) {
+    throw std::runtime_error( fileName + " is not a binary trace" );
+  }
+
+  if( ( head.version != TraceHeader::fixed && head.version != TraceHeader::delta ) ||
+      head.recordSize != sizeof( TraceRecord ) ) {
+    throw std::runtime_error( fileName + " has an unsupported trace version" );
+  }
+
+  is.seekg( 0, std::ios::end );
+  fileSize = is.tellg();
+  is.seekg( sizeof( head ) );
+
+  if( head.version == TraceHeader::delta ) {
+    codec = std::make_unique< TraceCodec >( opcodes );
+    block.resize( TraceCodec::blockSize );
+    blockCount = ( fileSize - sizeof( head ) + TraceCodec::blockSize - 1 ) / TraceCodec::blockSize;
+  }
+}
+
+TraceReader::~TraceReader() {}
+
+bool
+TraceReader::next( TraceRecord& record ) {
+  if( held ) {
+    held = false;
+    record = heldRecord;
+    return true;
+  }
+
+  if( !codec ) {
+    if( !is.read( reinterpret_cast< char* >( &record ), sizeof( record ) ) ) {
+      return false;
+    }
+
+    // Ticks start at 1, so a zero tick is the unused tail of a trace that was never closed
+    return record.tick != 0;
+  }
+
+  if( position < blockUsed ) {
+    position += codec->decode( &block[ position ], record );
+    return true;
+  }
+
+  return nextBlock < blockCount && loadBlock( nextBlock++, record );
+}
+
+bool
+TraceReader::readFixed( u64 index, TraceRecord& record ) {
+  is.clear();
+  is.seekg( sizeof( head ) + index * sizeof( record ) );
+  return is.read( reinterpret_cast< char* >( &record ), sizeof( record ) ) && record.tick != 0;
+}
+
+bool
+TraceReader::loadBlock( u64 index, TraceRecord& keyframe ) {
+  is.clear();
+  is.seekg( sizeof( head ) + index * TraceCodec::blockSize );
+  is.read( reinterpret_cast< char* >( block.data() ), block.size() );
+  std::size_t got = is.gcount();
+
+  u32 used = 0;
+  if( got >= TraceCodec::blockHeaderSize ) {
+    std::memcpy( &used, block.data(), sizeof( used ) );
+  }
+  if( used < TraceCodec::blockHeaderSize || used > got ) {
+    blockUsed = position = 0;
+    return false;
+  }
+
+  std::memcpy( &keyframe, block.data() + sizeof( used ), sizeof( keyframe ) );
+  codec->reset( keyframe );
+  blockUsed = used;
+  position = TraceCodec::blockHeaderSize;
+
+  return true;
+}
+
+void
+TraceReader::seek( u64 tick ) {
+  held = false;
+  TraceRecord record;
+
+  if( !codec ) {
+    // First record at or after tick; the unused tail of a trace counts as after everything
+    u64 low = 0;
+    u64 high = ( fileSize - sizeof( head ) ) / sizeof( record );
+    while( low < high ) {
+      u64 middle = low + ( high - low ) / 2;
+      if( readFixed( middle, record ) && record.tick < tick ) {
+        low = middle + 1;
+      }
+      else {
+        high = middle;
+      }
+    }
+
+    is.clear();
+    is.seekg( sizeof( head ) + low * sizeof( record ) );
+    return;
+  }
+
+  // Last block whose keyframe is at or before tick
+  u64 low = 0;
+  u64 high = blockCount;
+  while( high - low > 1 ) {
+    u64 middle = low + ( high - low ) / 2;
+    if( loadBlock( middle, record ) && record.tick <= tick ) {
+      low = middle;
+    }
+    else {
+      high = middle;
+    }
+  }
+
+  nextBlock = low + 1;
+  if( !loadBlock( low, record ) ) {
+    nextBlock = blockCount;
+    return;
+  }
+
+  do {
+    if( record.tick >= tick ) {
+      held = true;
+      heldRecord = record;
+      return;
+    }
+  } while( next( record ) );
+}
@@ -0,0 +1,237 @@
+#include <cstring>
+
+#include "../include/tracecodec.hh"
+
+static const u16 prefixOpcode = 0xcb;
+
+static inline u8*
+putVarint( u8* p, u64 value ) {
+  while( value >= 0x80 ) {
+    *p++ = static_cast< u8 >( value ) | 0x80;
+    value >>= 7;
+  }
+  *p++ = static_cast< u8 >( value );
+  return p;
+}
+
+static inline const u8*
+getVarint( const u8* p, u64& value ) {
+  value = 0;
+  for( int shift = 0;; shift += 7 ) {
+    u8 byte = *p++;
+    value |= static_cast< u64 >( byte & 0x7f ) << shift;
+    if( ( byte & 0x80 ) == 0 ) {
+      return p;
+    }
+  }
+}
+
+// Small changes in either direction, including wrapping around, become small numbers
+static inline u8*
+putDelta( u8* p, u16 from, u16 to ) {
+  auto delta = static_cast< i16 >( to - from );
+  return putVarint( p, static_cast< u16 >( ( delta << 1 ) ^ ( delta >> 15 ) ) );
+}
+
+static inline const u8*
+getDelta( const u8* p, u16 from, u16& to ) {
+  u64 zigzag;
+  p = getVarint( p, zigzag );
+  auto delta = static_cast< u16 >( ( zigzag >> 1 ) ^ -( zigzag & 1 ) );
+  to = from + delta;
+  return p;
+}
+
+TraceCodec::TraceCodec( const TraceOpcodes& opcodes )
+  : opcodes( opcodes ),
+    shadow( 0x10000 + 256 * 0x4000, 0 ) {
+  std::memset( &previous, 0, sizeof( previous ) );
+}
+
+u32
+TraceCodec::shadowIndex( u16 address, u8 bank ) {
+  if( 0x4000 <= address && address < 0x8000 ) {
+    return 0x10000 + bank * 0x4000 + ( address - 0x4000 );
+  }
+  return address;
+}
+
+void
+TraceCodec::remember( const TraceRecord& record ) {
+  for( int i = 0; i < 4; i++ ) {
+    auto index = shadowIndex( record.pc + i, record.bank );
+    if( shadow[ index ] == 0 && record.pcmem[ i ] != 0 ) {
+      touched.push_back( index );
+    }
+    shadow[ index ] = record.pcmem[ i ];
+  }
+
+  previous = record;
+}
+
+u16
+TraceCodec::predictOpcode( u8 byte ) {
+  return previous.opcode == prefixOpcode ? byte | 0x100 : byte;
+}
+
+void
+TraceCodec::reset( const TraceRecord& keyframe ) {
+  for( auto index : touched ) {
+    shadow[ index ] = 0;
+  }
+  touched.clear();
+
+  remember( keyframe );
+}
+
+std::size_t
+TraceCodec::encode( const TraceRecord& record, u8* out ) {
+  u8 mask = 0;
+  u8* p = out + 1;
+
+  u64 predictedTick = previous.tick + opcodes.cycles[ previous.opcode ];
+  if( record.tick != predictedTick ) {
+    mask |= changedTick;
+    p = putVarint( p, record.tick - previous.tick );
+  }
+
+  if( record.AF != previous.AF ) {
+    mask |= changedAF;
+    p = putDelta( p, previous.AF, record.AF );
+  }
+  if( record.BC != previous.BC ) {
+    mask |= changedBC;
+    p = putDelta( p, previous.BC, record.BC );
+  }
+  if( record.DE != previous.DE ) {
+    mask |= changedDE;
+    p = putDelta( p, previous.DE, record.DE );
+  }
+  if( record.HL != previous.HL ) {
+    mask |= changedHL;
+    p = putDelta( p, previous.HL, record.HL );
+  }
+  if( record.SP != previous.SP ) {
+    mask |= changedSP;
+    p = putDelta( p, previous.SP, record.SP );
+  }
+  if( record.pc != previous.nextPC ) {
+    mask |= changedPC;
+    p = putDelta( p, previous.nextPC, record.pc );
+  }
+
+  u8 extra = 0;
+  u8* extraAt = p++;
+
+  if( record.bank != previous.bank ) {
+    extra |= changedBank;
+    *p++ = record.bank;
+  }
+  if( record.flags != 0 ) {
+    extra |= hasFlags;
+    *p++ = record.flags;
+  }
+  for( int i = 0; i < 4; i++ ) {
+    if( record.pcmem[ i ] != shadow[ shadowIndex( record.pc + i, record.bank ) ] ) {
+      extra |= 1 << i;
+      *p++ = record.pcmem[ i ];
+    }
+  }
+  if( record.opcode != predictOpcode( record.pcmem[ 0 ] ) ) {
+    extra |= changedOpcode;
+    p = putVarint( p, record.opcode );
+  }
+  u16 predictedNextPC = record.pc + opcodes.bytes[ record.opcode ];
+  if( record.nextPC != predictedNextPC ) {
+    extra |= changedNextPC;
+    p = putDelta( p, predictedNextPC, record.nextPC );
+  }
+
+  if( extra != 0 ) {
+    mask |= hasExtra;
+    *extraAt = extra;
+  }
+  else {
+    // Nothing was written after the extra byte
+    p--;
+  }
+
+  out[ 0 ] = mask;
+  remember( record );
+
+  return p - out;
+}
+
+std::size_t
+TraceCodec::decode( const u8* in, TraceRecord& record ) {
+  const u8* p = in;
+  u8 mask = *p++;
+
+  record = previous;
+
+  if( mask & changedTick ) {
+    u64 delta;
+    p = getVarint( p, delta );
+    record.tick = previous.tick + delta;
+  }
+  else {
+    record.tick = previous.tick + opcodes.cycles[ previous.opcode ];
+  }
+
+  if( mask & changedAF ) {
+    p = getDelta( p, previous.AF, record.AF );
+  }
+  if( mask & changedBC ) {
+    p = getDelta( p, previous.BC, record.BC );
+  }
+  if( mask & changedDE ) {
+    p = getDelta( p, previous.DE, record.DE );
+  }
+  if( mask & changedHL ) {
+    p = getDelta( p, previous.HL, record.HL );
+  }
+  if( mask & changedSP ) {
+    p = getDelta( p, previous.SP, record.SP );
+  }
+
+  record.pc = previous.nextPC;
+  if( mask & changedPC ) {
+    p = getDelta( p, previous.nextPC, record.pc );
+  }
+
+  u8 extra = mask & hasExtra ? *p++ : 0;
+
+  if( extra & changedBank ) {
+    record.bank = *p++;
+  }
+  record.flags = extra & hasFlags ? *p++ : 0;
+
+  for( int i = 0; i < 4; i++ ) {
+    if( extra & ( 1 << i ) ) {
+      record.pcmem[ i ] = *p++;
+    }
+    else {
+      record.pcmem[ i ] = shadow[ shadowIndex( record.pc + i, record.bank ) ];
+    }
+  }
+
+  record.opcode = predictOpcode( record.pcmem[ 0 ] );
+  if( extra & changedOpcode ) {
+    u64 opcode;
+    p = getVarint( p, opcode );
+    record.opcode = static_cast< u16 >( opcode );
+  }
+
+  record.nextPC = record.pc + opcodes.bytes[ record.opcode ];
+  if( extra & changedNextPC ) {
+    p = getDelta( p, record.nextPC, record.nextPC );
+  }
+
+  // Operands are the bytes after the opcode
+  record.params[ 0 ] = record.pcmem[ 1 ];
+  record.params[ 1 ] = record.pcmem[ 2 ];
+
+  remember( record );
+
+  return p - in;
+}
@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include "../include/tracefilter.hh"
+
+#include "../include/bus.hh"
+
+TraceFilter::TraceFilter() {
+  std::fill( std::begin( pages ), std::end( pages ), all );
+  std::fill( std::begin( bits ), std::end( bits ), ~0ull );
+
+  auto rangesValue = conf->GetValue( "TracePC" );
+  auto bankValue = conf->GetValue( "TraceBank" );
+
+  if( !rangesValue.empty() || !bankValue.empty() ) {
+    std::fill( std::begin( pages ), std::end( pages ), none );
+    std::fill( std::begin( bits ), std::end( bits ), 0 );
+
+    if( !rangesValue.empty() ) {
+      parseRanges( rangesValue );
+    }
+    else {
+      addRange( 0x4000, 0x7fff );
+    }
+    enabled = true;
+  }
+
+  if( !bankValue.empty() ) {
+    bank = conf->GetNumber( "TraceBank", 0, 0 );
+    slowChecks = true;
+  }
+
+  auto startValue = conf->GetValue( "TraceStart" );
+  if( !startValue.empty() ) {
+    startTick = conf->GetNumber( "TraceStart", 0 );
+    enabled = true;
+  }
+
+  auto stopValue = conf->GetValue( "TraceStop" );
+  if( !stopValue.empty() ) {
+    stopTick = conf->GetNumber( "TraceStop", 0 );
+    enabled = true;
+  }
+
+  auto afterValue = conf->GetValue( "TraceAfterPC" );
+  if( !afterValue.empty() ) {
+    armPC = conf->GetNumber( "TraceAfterPC", 0, 16 );
+    armed = false;
+    enabled = true;
+  }
+
+  auto everyValue = conf->GetValue( "TraceEvery" );
+  if( !everyValue.empty() ) {
+    every = std::max< u64 >( conf->GetNumber( "TraceEvery", 1 ), 1 );
+    slowChecks = slowChecks || every > 1;
+    enabled = true;
+  }
+}
+
+void
+TraceFilter::initialize( Bus* bus ) {
+  this->bus = bus;
+}
+
+void
+TraceFilter::parseRanges( const std::string& list ) {
+  std::stringstream ss{ list };
+  std::string range;
+
+  while( std::getline( ss, range, ',' ) ) {
+    auto dash = range.find( '-' );
+
+    try {
+      u16 first = std::stoul( range.substr( 0, dash ), nullptr, 16 );
+      u16 last = dash == std::string::npos ? first : std::stoul( range.substr( dash + 1 ), nullptr, 16 );
+      addRange( first, last );
+    }
+    catch( std::logic_error& ) {
+      throw std::runtime_error( "TracePC: can't read the range " + range );
+    }
+  }
+}
+
+void
+TraceFilter::addRange( u16 first, u16 last ) {
+  for( u32 address = first; address <= last; address++ ) {
+    bits[ address >> 6 ] |= 1ull << ( address & 63 );
+  }
+
+  // Sort the pages the range touches into all or mixed
+  for( u32 page = first >> 8; page <= ( last >> 8 ); page++ ) {
+    bool full = true;
+    for( u32 word = page * 4; word < page * 4 + 4; word++ ) {
+      full = full && bits[ word ] == ~0ull;
+    }
+    pages[ page ] = full ? all : mixed;
+  }
+}
+
+bool
+TraceFilter::acceptSlow( u16 pc ) {
+  if( bank >= 0 && 0x4000 <= pc && pc < 0x8000 && bus->romBank() != bank ) {
+    return false;
+  }
+
+  return ++count % every == 0;
+}